@@ -0,0 +1,215 @@
+/*
+ *  affinity module
+ *  CPU and NUMA aware placement of producer and consumer threads
+ *
+ *  The machine's layout comes from /sys: for every CPU this process may
+ *  run on, its NUMA node, package, core and hyperthread index.
+ *  PlacementPlan() turns a policy into one CPU per worker, which main
+ *  applies with pthread_attr_setaffinity_np() before the thread starts.
+ *
+ *  Matrices are allocated and filled by producers, so their pages are
+ *  first-touched on the producer's node.  The paired policy keeps producer
+ *  i on consumer i's core and node.  With --buffer=sharded both also share
+ *  home shard i, so most matrices never leave that node.
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+// Include only libraries for this module
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <dirent.h>
+#include "affinity.h"
+
+static const char *policyNames[] = {"none", "compact", "scatter", "paired"};
+
+int PlacementParse(const char *name)
+{
+  for (int i = 0; i < (int)(sizeof(policyNames) / sizeof(policyNames[0])); i++)
+  {
+    if (strcmp(name, policyNames[i]) == 0)
+      return i;
+  }
+  return -1;
+}
+
+const char *PlacementName(int policy)
+{
+  return policyNames[policy];
+}
+
+// Integer in /sys/devices/system/cpu/cpu<cpu>/<file>, or -1
+static int read_cpu_int(int cpu, const char *file)
+{
+  char path[128];
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/%s", cpu, file);
+  FILE *f = fopen(path, "r");
+  if (f == NULL)
+    return -1;
+  int v = -1;
+  if (fscanf(f, "%d", &v) != 1)
+    v = -1;
+  fclose(f);
+  return v;
+}
+
+// NUMA node of cpu, from its node<N> link in /sys; 0 if there is none
+int CpuNode(int cpu)
+{
+  char path[64];
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+  DIR *d = opendir(path);
+  if (d == NULL)
+    return 0;
+  int node = 0;
+  struct dirent *e;
+  while ((e = readdir(d)) != NULL)
+  {
+    if (strncmp(e->d_name, "node", 4) == 0 && e->d_name[4] >= '0' && e->d_name[4] <= '9')
+    {
+      node = atoi(e->d_name + 4);
+      break;
+    }
+  }
+  closedir(d);
+  return node;
+}
+
+// Layout of every CPU in our affinity mask, in CPU number order.
+// Returns the count, *cpus is malloc'd.
+static int read_topology(CpuInfo **cpus)
+{
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  sched_getaffinity(0, sizeof(allowed), &allowed);
+
+  int n = 0;
+  *cpus = (CpuInfo *)malloc(sizeof(CpuInfo) * CPU_SETSIZE);
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+  {
+    if (!CPU_ISSET(cpu, &allowed))
+      continue;
+    CpuInfo *ci = &(*cpus)[n++];
+    ci->cpu = cpu;
+    ci->node = CpuNode(cpu);
+    ci->package = read_cpu_int(cpu, "topology/physical_package_id");
+    ci->core = read_cpu_int(cpu, "topology/core_id");
+    if (ci->core < 0)
+      ci->core = cpu; // no topology, every CPU its own core
+    ci->smt = 0;
+    for (int j = 0; j < n - 1; j++)
+    {
+      // earlier CPUs on the same core come first
+      CpuInfo *o = &(*cpus)[j];
+      if (o->package == ci->package && o->core == ci->core)
+        ci->smt++;
+    }
+  }
+  return n;
+}
+
+// node, package, core, hyperthread: neighbours share as much as possible
+static int cmp_compact(const void *x, const void *y)
+{
+  const CpuInfo *a = (const CpuInfo *)x, *b = (const CpuInfo *)y;
+  if (a->node != b->node)
+    return a->node - b->node;
+  if (a->package != b->package)
+    return a->package - b->package;
+  if (a->core != b->core)
+    return a->core - b->core;
+  return a->smt - b->smt;
+}
+
+// Scatter order: first hyperthreads before second ones, and within those,
+// round robin over nodes, so neighbours share as little as possible.  rank
+// is a CPU's position among the CPUs with the same node and smt.
+typedef struct scatterkey
+{
+  CpuInfo info;
+  int rank;
+} ScatterKey;
+
+static int cmp_scatter(const void *x, const void *y)
+{
+  const ScatterKey *a = (const ScatterKey *)x, *b = (const ScatterKey *)y;
+  if (a->info.smt != b->info.smt)
+    return a->info.smt - b->info.smt;
+  if (a->rank != b->rank)
+    return a->rank - b->rank;
+  return a->info.node - b->info.node;
+}
+
+static void order_scatter(CpuInfo *cpus, int n)
+{
+  qsort(cpus, n, sizeof(CpuInfo), cmp_compact);
+  ScatterKey *keys = (ScatterKey *)malloc(sizeof(ScatterKey) * n);
+  for (int i = 0; i < n; i++)
+  {
+    keys[i].info = cpus[i];
+    keys[i].rank = 0;
+    for (int j = 0; j < i; j++)
+    {
+      if (cpus[j].node == cpus[i].node && cpus[j].smt == cpus[i].smt)
+        keys[i].rank++;
+    }
+  }
+  qsort(keys, n, sizeof(ScatterKey), cmp_scatter);
+  for (int i = 0; i < n; i++)
+    cpus[i] = keys[i].info;
+  free(keys);
+}
+
+// Pick one CPU for each of nprod producers and ncons consumers, -1 for
+// "anywhere".  Workers beyond the number of CPUs wrap around.
+void PlacementPlan(int policy, int nprod, int ncons, int *prodCpu, int *consCpu)
+{
+  for (int i = 0; i < nprod; i++)
+    prodCpu[i] = -1;
+  for (int i = 0; i < ncons; i++)
+    consCpu[i] = -1;
+  if (policy == PLACE_NONE)
+    return;
+
+  CpuInfo *cpus;
+  int n = read_topology(&cpus);
+  if (n == 0)
+  {
+    free(cpus);
+    return;
+  }
+
+  if (policy == PLACE_SCATTER)
+    order_scatter(cpus, n);
+  else
+    qsort(cpus, n, sizeof(CpuInfo), cmp_compact);
+
+  if (policy == PLACE_PAIRED)
+  {
+    // compact order already puts a core's hyperthreads (or, without SMT,
+    // neighbouring cores) next to each other: pair i takes slots 2i, 2i+1
+    int pairs = nprod < ncons ? nprod : ncons;
+    int slot = 0;
+    for (int i = 0; i < pairs; i++)
+    {
+      prodCpu[i] = cpus[slot++ % n].cpu;
+      consCpu[i] = cpus[slot++ % n].cpu;
+    }
+    for (int i = pairs; i < nprod; i++)
+      prodCpu[i] = cpus[slot++ % n].cpu;
+    for (int i = pairs; i < ncons; i++)
+      consCpu[i] = cpus[slot++ % n].cpu;
+  }
+  else
+  {
+    int slot = 0;
+    for (int i = 0; i < nprod; i++)
+      prodCpu[i] = cpus[slot++ % n].cpu;
+    for (int i = 0; i < ncons; i++)
+      consCpu[i] = cpus[slot++ % n].cpu;
+  }
+  free(cpus);
+}
@@ -0,0 +1,36 @@
+/*
+ *  affinity header
+ *  Function prototypes, data, and constants for the thread placement module
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+// PLACEMENT POLICIES
+// PLACE_NONE    - leave workers to the scheduler
+// PLACE_COMPACT - producers then consumers packed onto as few cores and
+//                 nodes as possible
+// PLACE_SCATTER - producers then consumers spread over nodes, packages and
+//                 cores before doubling up on any of them
+// PLACE_PAIRED  - producer i and consumer i on sibling hyperthreads of one
+//                 core (neighbouring cores without SMT), pairs packed
+#define PLACE_NONE 0
+#define PLACE_COMPACT 1
+#define PLACE_SCATTER 2
+#define PLACE_PAIRED 3
+
+// Where one CPU sits in the machine
+typedef struct cpuinfo
+{
+  int cpu;
+  int node;
+  int package;
+  int core;
+  int smt; // index among the hyperthreads of its core
+} CpuInfo;
+
+// AFFINITY ROUTINES
+int PlacementParse(const char *name);
+const char *PlacementName(int policy);
+void PlacementPlan(int policy, int nprod, int ncons, int *prodCpu, int *consCpu);
+int CpuNode(int cpu);
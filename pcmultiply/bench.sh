@@ -0,0 +1,72 @@
+#!/bin/sh
+#
+# Benchmark sweep for pcMatrix
+#
+# Runs pcMatrix --bench once per combination of worker threads, bounded
+# buffer size, matrix count and matrix mode (times -r repeats) and collects
+# the record each run ends with: throughput plus p50/p99/p999/max of buffer
+# residency and put/get wait, as one CSV table or one JSON array.
+#
+# usage: ./bench.sh [-f csv|json] [-r repeats] [-t "threads..."] [-b "buffer_sizes..."]
+#                   [-n "matricies..."] [-m "matrix_modes..."] [-- pcMatrix options...]
+#
+#   e.g. ./bench.sh -t "1 2 4 8" -b "10 200" -- --buffer=lockfree --batch=8
+#
+# University of Washington, Tacoma
+# TCSS 422 - Operating Systems
+
+FORMAT=csv
+REPEAT=1
+THREADS="1 2 4 8"
+BUFS="10 200"
+LOOPS="1200"
+MODES="0 3"
+while getopts f:r:t:b:n:m: opt; do
+  case $opt in
+  f) FORMAT=$OPTARG ;;
+  r) REPEAT=$OPTARG ;;
+  t) THREADS=$OPTARG ;;
+  b) BUFS=$OPTARG ;;
+  n) LOOPS=$OPTARG ;;
+  m) MODES=$OPTARG ;;
+  *) sed -n 's/^# usage: /usage: /p' "$0" >&2; exit 1 ;;
+  esac
+done
+shift $((OPTIND - 1))
+case $FORMAT in
+csv | json) ;;
+*) echo "unknown format '$FORMAT', expected csv or json" >&2; exit 1 ;;
+esac
+
+first=1
+[ "$FORMAT" = json ] && echo "["
+for w in $THREADS; do
+  for buf in $BUFS; do
+    for loops in $LOOPS; do
+      for mode in $MODES; do
+        r=0
+        while [ "$r" -lt "$REPEAT" ]; do
+          out=$(./pcMatrix --quiet --bench="$FORMAT" "$@" "$w" "$buf" "$loops" "$mode")
+          if [ $? -ne 0 ]; then
+            echo "pcMatrix failed: threads=$w buffer=$buf matricies=$loops mode=$mode" >&2
+            exit 1
+          fi
+          if [ "$FORMAT" = json ]; then
+            [ $first -eq 1 ] || echo ","
+            printf "  %s" "$(echo "$out" | tail -n 1)"
+          else
+            # header once, then one row per run
+            [ $first -eq 1 ] && echo "$out" | tail -n 2 | head -n 1
+            echo "$out" | tail -n 1
+          fi
+          first=0
+          r=$((r + 1))
+        done
+      done
+    done
+  done
+done
+if [ "$FORMAT" = json ]; then
+  [ $first -eq 1 ] || echo
+  echo "]"
+fi
@@ -6,13 +6,34 @@
  *  TCSS 422 - Operating Systems
  */
 
+#include <stdatomic.h>
+
 // SYNCHRONIZED COUNTER
 
+// counter implementations
+// COUNTER_MUTEX   - value guarded by a pthread mutex (Three Easy Pieces)
+// COUNTER_ATOMIC  - one C11 atomic on its own cache line
+// COUNTER_SHARDED - one atomic per thread shard, get_cnt() sums the shards
+#define COUNTER_MUTEX 0
+#define COUNTER_ATOMIC 1
+#define COUNTER_SHARDED 2
+
+#define COUNTER_CACHE_LINE 64
+#define COUNTER_SHARDS 64
+
+// each shard owns a full cache line so threads never false-share
+typedef struct __countershard_t
+{
+  _Alignas(COUNTER_CACHE_LINE) atomic_int value;
+} countershard_t;
+
 // counter structures
 typedef struct __counter_t
 {
-  int value;
+  _Alignas(COUNTER_CACHE_LINE) atomic_int value;
+  int mode;
   pthread_mutex_t lock;
+  countershard_t *shards; // COUNTER_SHARDED only
 } counter_t;
 
 typedef struct __counters_t
@@ -23,6 +44,9 @@ typedef struct __counters_t
 
 // counter methods
 void init_cnt(counter_t *c);
+void init_cnt_mode(counter_t *c, int mode);
+void destroy_cnt(counter_t *c);
 void increment_cnt(counter_t *c);
 void decrement_cnt(counter_t *c);
 int get_cnt(counter_t *c);
+const char *cnt_mode_name(int mode);
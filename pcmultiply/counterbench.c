@@ -0,0 +1,95 @@
+/*
+ *  counterbench module
+ *  Microbenchmark for the synchronized counter implementations
+ *
+ *  Every thread increments one shared counter and, like the workers in
+ *  prodcons.c, reads it back every READ_EVERY operations.  Reports million
+ *  operations per second for each counter mode at 1, 2, 4, ... threads.
+ *
+ *  usage: ./counterBench [ops_per_thread [max_threads]]
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+#include "counter.h"
+#include "pcmatrix.h"
+
+#define DEFAULT_OPS 1000000
+#define DEFAULT_MAX_THREADS 64
+#define READ_EVERY 16
+
+typedef struct benchargs
+{
+  counter_t *counter;
+  long ops;
+  pthread_barrier_t *start;
+} BenchArgs;
+
+static void *bench_worker(void *arg)
+{
+  BenchArgs *args = (BenchArgs *)arg;
+  volatile int sink = 0;
+  pthread_barrier_wait(args->start);
+  for (long i = 0; i < args->ops; i++)
+  {
+    increment_cnt(args->counter);
+    if (i % READ_EVERY == 0)
+      sink += get_cnt(args->counter);
+  }
+  (void)sink;
+  return NULL;
+}
+
+// Returns million operations (increments + reads) per second
+static double run(int mode, int threads, long ops)
+{
+  counter_t *c = (counter_t *)aligned_alloc(COUNTER_CACHE_LINE, sizeof(counter_t));
+  init_cnt_mode(c, mode);
+
+  pthread_t tids[threads];
+  pthread_barrier_t start;
+  pthread_barrier_init(&start, NULL, threads + 1);
+  BenchArgs args = {c, ops, &start};
+  for (int i = 0; i < threads; i++)
+    pthread_create(&tids[i], NULL, bench_worker, &args);
+
+  struct timespec t0, t1;
+  pthread_barrier_wait(&start);
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for (int i = 0; i < threads; i++)
+    pthread_join(tids[i], NULL);
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+
+  double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+  if (get_cnt(c) != (int)(ops * threads))
+    fprintf(stderr, "%s counter lost updates: %d != %ld\n", cnt_mode_name(mode), get_cnt(c), ops * threads);
+
+  pthread_barrier_destroy(&start);
+  destroy_cnt(c);
+  free(c);
+  double total = (double)threads * (ops + (ops + READ_EVERY - 1) / READ_EVERY);
+  return total / secs / 1e6;
+}
+
+int main(int argc, char *argv[])
+{
+  long ops = argc > 1 ? atol(argv[1]) : DEFAULT_OPS;
+  int maxThreads = argc > 2 ? atoi(argv[2]) : DEFAULT_MAX_THREADS;
+  int modes[] = {COUNTER_MUTEX, COUNTER_ATOMIC, COUNTER_SHARDED};
+
+  printf("Counter microbenchmark: %ld increments per thread, get_cnt every %d\n", ops, READ_EVERY);
+  printf("%8s %14s %14s %14s   (Mops/sec)\n", "threads", "mutex", "atomic", "sharded");
+  for (int t = 1; t <= maxThreads; t *= 2)
+  {
+    printf("%8d", t);
+    for (int m = 0; m < 3; m++)
+      printf(" %14.2f", run(modes[m], t, ops));
+    printf("\n");
+  }
+  return 0;
+}
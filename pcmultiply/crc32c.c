@@ -0,0 +1,70 @@
+/*
+ *  crc32c module
+ *  CRC32C (Castagnoli) checksums of matrix elements
+ *
+ *  Uses the SSE4.2 crc32 instruction, 8 bytes at a time, when the CPU has
+ *  it and a byte-wise table otherwise.  Both give the standard CRC32C:
+ *  start from 0 and chain calls by passing the previous result back in.
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+// Include only libraries for this module
+#include <string.h>
+#include <pthread.h>
+#include <immintrin.h>
+#include "crc32c.h"
+
+#define CRC32C_POLY 0x82f63b78 // reflected Castagnoli polynomial
+
+static uint32_t crcTable[256];
+static int crcHardware;
+static pthread_once_t crcOnce = PTHREAD_ONCE_INIT;
+
+static void crc_init()
+{
+  __builtin_cpu_init();
+  crcHardware = __builtin_cpu_supports("sse4.2");
+  for (uint32_t i = 0; i < 256; i++)
+  {
+    uint32_t c = i;
+    for (int k = 0; k < 8; k++)
+      c = c & 1 ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+    crcTable[i] = c;
+  }
+}
+
+__attribute__((target("sse4.2"))) static uint32_t crc_hw(uint32_t crc, const unsigned char *p, size_t len)
+{
+  uint64_t c = crc;
+  for (; len >= 8; p += 8, len -= 8)
+  {
+    uint64_t w;
+    memcpy(&w, p, 8);
+    c = _mm_crc32_u64(c, w);
+  }
+  uint32_t c32 = (uint32_t)c;
+  for (; len > 0; p++, len--)
+    c32 = _mm_crc32_u8(c32, *p);
+  return c32;
+}
+
+static uint32_t crc_sw(uint32_t crc, const unsigned char *p, size_t len)
+{
+  for (; len > 0; p++, len--)
+    crc = crcTable[(crc ^ *p) & 0xff] ^ (crc >> 8);
+  return crc;
+}
+
+// CRC32C of len bytes at buf, continuing from crc (0 to start)
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len)
+{
+  pthread_once(&crcOnce, crc_init);
+  crc = ~crc;
+  if (crcHardware)
+    crc = crc_hw(crc, (const unsigned char *)buf, len);
+  else
+    crc = crc_sw(crc, (const unsigned char *)buf, len);
+  return ~crc;
+}
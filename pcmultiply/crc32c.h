@@ -0,0 +1,13 @@
+/*
+ *  crc32c header
+ *  Function prototypes for the CRC32C checksum module
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+// CRC32C ROUTINES
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len);
@@ -0,0 +1,92 @@
+/*
+ *  hist module
+ *  Log-linear latency histograms for the benchmark mode
+ *
+ *  Recording is a couple of shifts and an increment, so it can sit on the
+ *  put()/get() path without disturbing what it measures.
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+#include <string.h>
+#include "hist.h"
+
+// Bucket holding v
+static int bucket_of(uint64_t v)
+{
+  if (v < HIST_SUB)
+    return (int)v;
+  int msb = 63 - __builtin_clzll(v);
+  int shift = msb - HIST_SUB_BITS;
+  return (shift + 1) * HIST_SUB + (int)((v >> shift) - HIST_SUB);
+}
+
+// Largest value that lands in bucket b
+static uint64_t bucket_top(int b)
+{
+  if (b < HIST_SUB)
+    return (uint64_t)b;
+  int shift = b / HIST_SUB - 1;
+  uint64_t lo = (uint64_t)(HIST_SUB + b % HIST_SUB) << shift;
+  return lo + ((1ull << shift) - 1);
+}
+
+void hist_init(Hist *h)
+{
+  memset(h, 0, sizeof(Hist));
+  h->min = UINT64_MAX;
+}
+
+void hist_record(Hist *h, uint64_t v)
+{
+  h->buckets[bucket_of(v)]++;
+  h->count++;
+  h->sum += v;
+  if (v < h->min)
+    h->min = v;
+  if (v > h->max)
+    h->max = v;
+}
+
+void hist_merge(Hist *dst, const Hist *src)
+{
+  for (int b = 0; b < HIST_BUCKETS; b++)
+    dst->buckets[b] += src->buckets[b];
+  dst->count += src->count;
+  dst->sum += src->sum;
+  if (src->min < dst->min)
+    dst->min = src->min;
+  if (src->max > dst->max)
+    dst->max = src->max;
+}
+
+// Value at or below which a fraction p (0..1) of the samples fall, rounded
+// up to the top of its bucket.  0 for an empty histogram.
+uint64_t hist_percentile(const Hist *h, double p)
+{
+  if (h->count == 0)
+    return 0;
+  uint64_t rank = (uint64_t)(p * h->count + 0.5);
+  if (rank < 1)
+    rank = 1;
+  if (rank > h->count)
+    rank = h->count;
+
+  uint64_t seen = 0;
+  for (int b = 0; b < HIST_BUCKETS; b++)
+  {
+    seen += h->buckets[b];
+    if (seen >= rank)
+    {
+      uint64_t top = bucket_top(b);
+      return top < h->max ? top : h->max;
+    }
+  }
+  return h->max;
+}
+
+double hist_mean(const Hist *h)
+{
+  return h->count > 0 ? (double)h->sum / h->count : 0.0;
+}
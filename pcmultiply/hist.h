@@ -0,0 +1,43 @@
+/*
+ *  hist header
+ *  Function prototypes, data, and constants for the latency histogram module
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+#include <stdint.h>
+#include <time.h>
+
+// Log-linear buckets: values below HIST_SUB get a bucket each, above that
+// every power of two is split into HIST_SUB equal sub-buckets, so any
+// recorded value is reported within 1/HIST_SUB (6.25%) of its true value.
+#define HIST_SUB_BITS 4
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+// Latency histogram, values in nanoseconds.  Not synchronized: each thread
+// records into its own and the main thread merges them after the join.
+typedef struct hist
+{
+  uint64_t count;
+  uint64_t sum;
+  uint64_t min;
+  uint64_t max;
+  uint64_t buckets[HIST_BUCKETS];
+} Hist;
+
+// Monotonic clock in nanoseconds
+static inline uint64_t now_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// HISTOGRAM ROUTINES
+void hist_init(Hist *h);
+void hist_record(Hist *h, uint64_t v);
+void hist_merge(Hist *dst, const Hist *src);
+uint64_t hist_percentile(const Hist *h, double p);
+double hist_mean(const Hist *h);
@@ -0,0 +1,182 @@
+/*
+ *  logger module
+ *  Serialized or asynchronous output for per-matrix messages
+ *
+ *  Workers bracket each message with LogBegin()/LogEnd() and write to the
+ *  FILE* they are handed, so a multi-line message is never interleaved with
+ *  another thread's.
+ *
+ *  Synchronous mode hands out stdout under flockfile().  Asynchronous mode
+ *  hands out a per-thread memory stream; LogEnd() queues the formatted text
+ *  and a dedicated logger thread writes it to stdout, so workers never wait
+ *  on terminal or pipe I/O.
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+// Include only libraries for this module
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <assert.h>
+#include "logger.h"
+
+typedef struct logchunk
+{
+  struct logchunk *next;
+  char *text;
+  size_t size;
+} LogChunk;
+
+static int logAsync = 0;
+static pthread_t logThread;
+
+// queue of formatted messages waiting for the logger thread
+static pthread_mutex_t logLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t logReady = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t logDrained = PTHREAD_COND_INITIALIZER;
+static LogChunk *logHead = NULL;
+static LogChunk *logTail = NULL;
+static size_t logPending = 0;
+static int logStopping = 0;
+
+// per-thread memory stream and its buffer (async mode), reused for every
+// message the thread logs
+static __thread FILE *myStream = NULL;
+static __thread char *myText = NULL;
+static __thread size_t mySize = 0;
+
+// closes a thread's memory stream when the thread exits
+static pthread_key_t streamKey;
+static pthread_once_t streamKeyOnce = PTHREAD_ONCE_INIT;
+
+static void close_stream(void *stream)
+{
+  fclose((FILE *)stream);
+  free(myText);
+  myText = NULL;
+}
+
+static void make_stream_key()
+{
+  pthread_key_create(&streamKey, close_stream);
+}
+
+static void *log_worker(void *arg)
+{
+  pthread_mutex_lock(&logLock);
+  for (;;)
+  {
+    while (logHead == NULL && !logStopping)
+      pthread_cond_wait(&logReady, &logLock);
+    if (logHead == NULL)
+      break; // stopping and fully drained
+
+    // take the whole queue and write it without holding the lock
+    LogChunk *chunks = logHead;
+    logHead = logTail = NULL;
+    pthread_mutex_unlock(&logLock);
+
+    size_t written = 0;
+    while (chunks != NULL)
+    {
+      LogChunk *next = chunks->next;
+      fwrite(chunks->text, 1, chunks->size, stdout);
+      written += chunks->size;
+      free(chunks);
+      chunks = next;
+    }
+
+    pthread_mutex_lock(&logLock);
+    logPending -= written;
+    pthread_cond_broadcast(&logDrained);
+  }
+  pthread_mutex_unlock(&logLock);
+  fflush(stdout);
+  return NULL;
+}
+
+void LogStart(int async)
+{
+  logAsync = async;
+  logStopping = 0;
+  if (logAsync)
+  {
+    int rc = pthread_create(&logThread, NULL, log_worker, NULL);
+    assert(rc == 0);
+  }
+}
+
+// Start a message, everything written to the returned stream until
+// LogEnd() comes out as one block
+FILE *LogBegin()
+{
+  if (!logAsync)
+  {
+    flockfile(stdout);
+    return stdout;
+  }
+  if (myStream == NULL)
+  {
+    myStream = open_memstream(&myText, &mySize);
+    assert(myStream != NULL);
+    pthread_once(&streamKeyOnce, make_stream_key);
+    pthread_setspecific(streamKey, myStream);
+  }
+  return myStream;
+}
+
+void LogEnd(FILE *out)
+{
+  if (!logAsync)
+  {
+    funlockfile(out);
+    return;
+  }
+
+  // flushing updates myText/mySize, copy the message out and rewind the
+  // stream so the next message reuses its buffer
+  fflush(out);
+  size_t size = mySize;
+  if (size == 0)
+    return;
+
+  LogChunk *chunk = (LogChunk *)malloc(sizeof(LogChunk) + size);
+  assert(chunk != NULL);
+  chunk->next = NULL;
+  chunk->text = (char *)(chunk + 1);
+  chunk->size = size;
+  memcpy(chunk->text, myText, size);
+  fseeko(out, 0, SEEK_SET);
+
+  pthread_mutex_lock(&logLock);
+  // back-pressure: don't let output pile up without bound
+  while (logPending >= LOG_MAX_PENDING)
+    pthread_cond_wait(&logDrained, &logLock);
+  if (logTail)
+    logTail->next = chunk;
+  else
+    logHead = chunk;
+  logTail = chunk;
+  logPending += chunk->size;
+  pthread_cond_signal(&logReady);
+  pthread_mutex_unlock(&logLock);
+}
+
+// Write out everything still queued and stop the logger thread
+void LogShutdown()
+{
+  if (!logAsync)
+  {
+    fflush(stdout);
+    return;
+  }
+  pthread_mutex_lock(&logLock);
+  logStopping = 1;
+  pthread_cond_signal(&logReady);
+  pthread_mutex_unlock(&logLock);
+  pthread_join(logThread, NULL);
+  logAsync = 0;
+}
@@ -0,0 +1,28 @@
+/*
+ *  logger header
+ *  Function prototypes, data, and constants for the logging module
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+#include <stdio.h>
+
+// VERBOSITY levels
+// LOG_QUIET    - no per-matrix output, only the configuration and summary
+// LOG_PRODUCTS - MULTIPLY lines and m1 X m2 = m3 results
+// LOG_ALL      - everything, including every PUT/GET and generated matrix
+#define LOG_QUIET 0
+#define LOG_PRODUCTS 1
+#define LOG_ALL 2
+
+#define LOG_ENABLED(level) (VERBOSITY >= (level))
+
+// Writers block once this much text is waiting for the logger thread
+#define LOG_MAX_PENDING (8 * 1024 * 1024)
+
+// LOGGER ROUTINES
+void LogStart(int async);
+FILE *LogBegin();
+void LogEnd(FILE *out);
+void LogShutdown();
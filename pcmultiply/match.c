@@ -0,0 +1,147 @@
+/*
+ *  match module
+ *  Index of matrices waiting for a multiplication partner
+ *
+ *  A consumer in matching mode never throws a matrix away just because it
+ *  does not fit the one it is holding.  Every dequeued matrix X is first
+ *  checked against the pending matrices: a pending A with A.cols == X.rows
+ *  gives A x X, a pending B with X.cols == B.rows gives X x B.  Otherwise X
+ *  waits in the index.  Lookups go through buckets keyed by rows and by
+ *  cols, so they cost O(1) plus the length of one short chain.
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+// Include only libraries for this module
+#include <stdio.h>
+#include <stdlib.h>
+#include "matrix.h"
+#include "match.h"
+
+void match_init(MatchIndex *mi)
+{
+  for (int i = 0; i < MATCH_BUCKETS; i++)
+  {
+    mi->byRows[i] = NULL;
+    mi->byCols[i] = NULL;
+  }
+  mi->oldest = mi->newest = NULL;
+  mi->freeNodes = NULL;
+  for (int i = 0; i < MATCH_MAX_PENDING; i++)
+  {
+    mi->nodes[i].nextRows = mi->freeNodes;
+    mi->freeNodes = &mi->nodes[i];
+  }
+  mi->pending = 0;
+}
+
+static void unlink_node(MatchIndex *mi, MatchNode *n)
+{
+  // rows chain
+  if (n->prevRows)
+    n->prevRows->nextRows = n->nextRows;
+  else
+    mi->byRows[n->mat->rows % MATCH_BUCKETS] = n->nextRows;
+  if (n->nextRows)
+    n->nextRows->prevRows = n->prevRows;
+
+  // cols chain
+  if (n->prevCols)
+    n->prevCols->nextCols = n->nextCols;
+  else
+    mi->byCols[n->mat->cols % MATCH_BUCKETS] = n->nextCols;
+  if (n->nextCols)
+    n->nextCols->prevCols = n->prevCols;
+
+  // age order
+  if (n->older)
+    n->older->newer = n->newer;
+  else
+    mi->oldest = n->newer;
+  if (n->newer)
+    n->newer->older = n->older;
+  else
+    mi->newest = n->older;
+
+  n->nextRows = mi->freeNodes;
+  mi->freeNodes = n;
+  mi->pending--;
+}
+
+// Remove and return a pending matrix that can be multiplied with x, or NULL.
+// *partnerFirst tells the caller the product order: 1 for partner x x,
+// 0 for x x partner.
+Matrix *match_partner(MatchIndex *mi, Matrix *x, int *partnerFirst)
+{
+  for (MatchNode *n = mi->byCols[x->rows % MATCH_BUCKETS]; n != NULL; n = n->nextCols)
+  {
+    if (n->mat->cols == x->rows)
+    {
+      Matrix *m = n->mat;
+      unlink_node(mi, n);
+      *partnerFirst = 1;
+      return m;
+    }
+  }
+  for (MatchNode *n = mi->byRows[x->cols % MATCH_BUCKETS]; n != NULL; n = n->nextRows)
+  {
+    if (n->mat->rows == x->cols)
+    {
+      Matrix *m = n->mat;
+      unlink_node(mi, n);
+      *partnerFirst = 0;
+      return m;
+    }
+  }
+  return NULL;
+}
+
+// Park x until a partner shows up.  If the index is full the oldest pending
+// matrix is removed to make room and returned, otherwise NULL.
+Matrix *match_insert(MatchIndex *mi, Matrix *x)
+{
+  Matrix *evicted = NULL;
+  if (mi->freeNodes == NULL)
+    evicted = match_pop(mi);
+
+  MatchNode *n = mi->freeNodes;
+  mi->freeNodes = n->nextRows;
+  n->mat = x;
+
+  int r = x->rows % MATCH_BUCKETS;
+  n->prevRows = NULL;
+  n->nextRows = mi->byRows[r];
+  if (n->nextRows)
+    n->nextRows->prevRows = n;
+  mi->byRows[r] = n;
+
+  int c = x->cols % MATCH_BUCKETS;
+  n->prevCols = NULL;
+  n->nextCols = mi->byCols[c];
+  if (n->nextCols)
+    n->nextCols->prevCols = n;
+  mi->byCols[c] = n;
+
+  n->newer = NULL;
+  n->older = mi->newest;
+  if (mi->newest)
+    mi->newest->newer = n;
+  else
+    mi->oldest = n;
+  mi->newest = n;
+
+  mi->pending++;
+  return evicted;
+}
+
+// Remove and return the oldest pending matrix, NULL when empty
+Matrix *match_pop(MatchIndex *mi)
+{
+  MatchNode *n = mi->oldest;
+  if (n == NULL)
+    return NULL;
+  Matrix *m = n->mat;
+  unlink_node(mi, n);
+  return m;
+}
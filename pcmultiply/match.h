@@ -0,0 +1,38 @@
+/*
+ *  match header
+ *  Function prototypes, data, and constants for the pair matching module
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+// Pending matrices are hashed by dimension into this many buckets
+#define MATCH_BUCKETS 64
+// Most matrices a consumer keeps waiting for a partner, the oldest is
+// dropped when a new one does not fit
+#define MATCH_MAX_PENDING 256
+
+typedef struct matchnode
+{
+  Matrix *mat;
+  struct matchnode *prevRows, *nextRows; // chain in byRows[rows % MATCH_BUCKETS]
+  struct matchnode *prevCols, *nextCols; // chain in byCols[cols % MATCH_BUCKETS]
+  struct matchnode *older, *newer;       // age order, for eviction
+} MatchNode;
+
+// Per-consumer index of matrices still waiting for a partner
+typedef struct matchindex
+{
+  MatchNode *byRows[MATCH_BUCKETS];
+  MatchNode *byCols[MATCH_BUCKETS];
+  MatchNode *oldest, *newest;
+  MatchNode *freeNodes;
+  MatchNode nodes[MATCH_MAX_PENDING];
+  int pending;
+} MatchIndex;
+
+// MATCH ROUTINES
+void match_init(MatchIndex *mi);
+Matrix *match_partner(MatchIndex *mi, Matrix *x, int *partnerFirst);
+Matrix *match_insert(MatchIndex *mi, Matrix *x);
+Matrix *match_pop(MatchIndex *mi);
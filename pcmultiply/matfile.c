@@ -0,0 +1,139 @@
+/*
+ *  matfile module
+ *  Streams matrices out of a memory-mapped binary file
+ *
+ *  Instead of generating matrices, producers can replay a recorded
+ *  workload.  The file is mapped read-only and every matrix handed out is
+ *  a view: a small header whose element pointer points straight into the
+ *  mapping.  Nothing is parsed or copied, the elements come in at page
+ *  cache speed, and FreeMatrix() only releases the header.
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+// Include only libraries for this module
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "matrix.h"
+#include "matfile.h"
+
+// Map path and index its records.  Returns -1 with a message on stderr if
+// the file cannot be read or is not a well-formed matrix file.
+int matfile_open(MatFile *mf, const char *path)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+  {
+    perror(path);
+    return -1;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0)
+  {
+    perror(path);
+    close(fd);
+    return -1;
+  }
+  mf->size = (size_t)st.st_size;
+  if (mf->size < sizeof(MatFileHeader))
+  {
+    fprintf(stderr, "%s: not a matrix file\n", path);
+    close(fd);
+    return -1;
+  }
+  void *base = mmap(NULL, mf->size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED)
+  {
+    perror(path);
+    return -1;
+  }
+  mf->base = (const char *)base;
+
+  const MatFileHeader *h = (const MatFileHeader *)mf->base;
+  if (h->magic != MATFILE_MAGIC || h->count <= 0)
+  {
+    fprintf(stderr, "%s: not a matrix file\n", path);
+    munmap(base, mf->size);
+    return -1;
+  }
+
+  // one pass over the record headers, the elements are not touched
+  mf->count = h->count;
+  mf->offsets = (size_t *)malloc(sizeof(size_t) * mf->count);
+  size_t off = sizeof(MatFileHeader);
+  for (int i = 0; i < mf->count; i++)
+  {
+    const MatRecord *r = (const MatRecord *)(mf->base + off);
+    if (off + sizeof(MatRecord) > mf->size || r->rows <= 0 || r->cols <= 0 ||
+        (mf->size - off - sizeof(MatRecord)) / sizeof(int32_t) / r->rows < (size_t)r->cols)
+    {
+      fprintf(stderr, "%s: matrix %d is truncated or malformed\n", path, i);
+      free(mf->offsets);
+      munmap(base, mf->size);
+      return -1;
+    }
+    mf->offsets[i] = off;
+    off += sizeof(MatRecord) + (size_t)r->rows * r->cols * sizeof(int32_t);
+  }
+
+  // the whole file is about to be streamed through front to back
+  madvise(base, mf->size, MADV_SEQUENTIAL);
+  return 0;
+}
+
+// Unmap the file, only once every view handed out has been freed
+void matfile_close(MatFile *mf)
+{
+  munmap((void *)mf->base, mf->size);
+  free(mf->offsets);
+  mf->base = NULL;
+  mf->offsets = NULL;
+}
+
+// Zero-copy view of matrix i.  The elements are read-only.  Nothing was
+// generated, so the sum consumers check against is taken here.
+Matrix *matfile_view(const MatFile *mf, int i)
+{
+  const MatRecord *r = (const MatRecord *)(mf->base + mf->offsets[i]);
+  Matrix *mat = AllocMatrixView(r->rows, r->cols, (int *)r->elems);
+  StampMatrix(mat);
+  return mat;
+}
+
+// Write count generated matrices (MATRIX_MODE, stream 0 of RNG_SEED) to
+// path, for replaying later.  Returns -1 with a message on stderr on failure.
+int matfile_write(const char *path, int count)
+{
+  FILE *f = fopen(path, "wb");
+  if (f == NULL)
+  {
+    perror(path);
+    return -1;
+  }
+  MatFileHeader h = {MATFILE_MAGIC, count};
+  int ok = fwrite(&h, sizeof(h), 1, f) == 1;
+  for (int i = 0; ok && i < count; i++)
+  {
+    Matrix *mat = GenMatrixRandom();
+    int32_t dims[2] = {mat->rows, mat->cols};
+    ok = fwrite(dims, sizeof(dims), 1, f) == 1;
+    for (int r = 0; ok && r < mat->rows; r++)
+      ok = fwrite(MROW(mat, r), sizeof(int32_t), mat->cols, f) == (size_t)mat->cols;
+    FreeMatrix(mat);
+  }
+  if (fclose(f) != 0)
+    ok = 0;
+  if (!ok)
+  {
+    perror(path);
+    return -1;
+  }
+  return 0;
+}
@@ -0,0 +1,43 @@
+/*
+ *  matfile header
+ *  Function prototypes, data, and constants for the matrix file module
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+// File layout, all fields native-endian int32:
+//   "PCMX" magic, matrix count,
+//   then per matrix: rows, cols, rows * cols elements in row-major order
+#define MATFILE_MAGIC 0x584d4350 // "PCMX" read as a little-endian int32
+
+typedef struct matfileheader
+{
+  int32_t magic;
+  int32_t count;
+} MatFileHeader;
+
+typedef struct matrecord
+{
+  int32_t rows;
+  int32_t cols;
+  int32_t elems[]; // rows * cols
+} MatRecord;
+
+// A matrix file mapped read-only, with the offset of every record
+typedef struct matfile
+{
+  const char *base;
+  size_t size;
+  int count;
+  size_t *offsets;
+} MatFile;
+
+// MATRIX FILE ROUTINES
+int matfile_open(MatFile *mf, const char *path);
+void matfile_close(MatFile *mf);
+Matrix *matfile_view(const MatFile *mf, int i);
+int matfile_write(const char *path, int count);
@@ -16,62 +16,161 @@
 #include <string.h>
 #include <time.h>
 #include "matrix.h"
+#include "mmkernel.h"
+#include "mmthreads.h"
+#include "pool.h"
+#include "logger.h"
+#include "rng.h"
+#include "crc32c.h"
 #include "pcmatrix.h"
 
 // MATRIX ROUTINES
-Matrix *AllocMatrix(int r, int c)
+
+// Bytes reserved for the Matrix header at the front of each block.  Rounded
+// up to MATRIX_ALIGN so the first row starts on its own cache line.
+#define MATRIX_HEADER_SIZE \
+  ((sizeof(Matrix) + MATRIX_ALIGN - 1) / MATRIX_ALIGN * MATRIX_ALIGN)
+
+static const char *elementNames[ELEM_TYPES] = {"int32", "int64", "float", "double"};
+static const size_t elementSizes[ELEM_TYPES] = {sizeof(int32_t), sizeof(int64_t), sizeof(float), sizeof(double)};
+
+// Element type by name, -1 if unknown
+int ElementParse(const char *name)
 {
-  Matrix *mat;
-  mat = (Matrix *)malloc(sizeof(Matrix));
-  int **a;
-  int i;
-  a = (int **)malloc(sizeof(int *) * r);
-  assert(a != 0);
-  for (i = 0; i < r; i++)
+  for (int i = 0; i < ELEM_TYPES; i++)
   {
-    a[i] = (int *)malloc(c * sizeof(int));
-    assert(a[i] != 0);
+    if (strcmp(name, elementNames[i]) == 0)
+      return i;
   }
-  mat->m = a;
+  return -1;
+}
+
+const char *ElementName(int type)
+{
+  return elementNames[type];
+}
+
+size_t ElementSize(int type)
+{
+  return elementSizes[type];
+}
+
+Matrix *AllocMatrix(int r, int c)
+{
+  size_t bytes = MATRIX_HEADER_SIZE + (size_t)r * c * ElementSize(ELEMENT_TYPE);
+  // aligned_alloc wants a size that is a multiple of the alignment
+  bytes = (bytes + MATRIX_ALIGN - 1) / MATRIX_ALIGN * MATRIX_ALIGN;
+  Matrix *mat;
+  if (MATRIX_POOL)
+    mat = (Matrix *)PoolAlloc(bytes);
+  else
+    mat = (Matrix *)aligned_alloc(MATRIX_ALIGN, bytes);
+  assert(mat != 0);
   mat->rows = r;
   mat->cols = c;
+  mat->stride = c;
+  mat->m = (int *)((char *)mat + MATRIX_HEADER_SIZE);
+  return mat;
+}
+
+// Header-only matrix over r x c elements that live elsewhere (matfile.c).
+// FreeMatrix() releases the header and leaves the elements alone.
+Matrix *AllocMatrixView(int r, int c, int *elems)
+{
+  Matrix *mat;
+  if (MATRIX_POOL)
+    mat = (Matrix *)PoolAlloc(MATRIX_HEADER_SIZE);
+  else
+    mat = (Matrix *)aligned_alloc(MATRIX_ALIGN, MATRIX_HEADER_SIZE);
+  assert(mat != 0);
+  mat->rows = r;
+  mat->cols = c;
+  mat->stride = c;
+  mat->m = elems;
   return mat;
 }
 
 void FreeMatrix(Matrix *mat)
 {
-  int r = mat->rows;
-  // int c = mat->cols;
-  int **a = mat->m;
-  int i;
-  for (i = 0; i < r; i++)
-  {
-    free(a[i]);
-  }
-  free(a);
-  free(mat);
+  // header and elements share one allocation (views: header only)
+  if (MATRIX_POOL)
+    PoolFree(mat);
+  else
+    free(mat);
 }
 
+// Fills mat and records its sum (and CRC with VERIFY_CRC) in the header
+// while each row is still in L1, so nobody has to traverse it again
 void GenMatrix(Matrix *mat)
 {
   int height = mat->rows;
   int width = mat->cols;
-  int **a = mat->m;
+  size_t rowBytes = width * ElementSize(ELEMENT_TYPE);
+  Rng *rng = rng_thread();
+  int64_t sum = 0;
+  uint32_t crc = 0;
   int i, j;
   for (i = 0; i < height; i++)
   {
-    for (j = 0; j < width; j++)
+    // the int32 values go at the front of the row and are widened in place,
+    // so every element type sees the same numbers for the same seed
+    int *mm = MROW(mat, i);
+    if (ElementSize(ELEMENT_TYPE) == sizeof(int64_t))
+      mm = (int *)MROW_AS(mat, m64, i);
+    if (MATRIX_MODE == 0)
+    {
+      rng_fill(rng, mm, width, 1, 10);
+    }
+    else
     {
-      int *mm = a[i];
-      if (MATRIX_MODE == 0)
-        mm[j] = 1 + rand() % 10;
-      else
+      for (j = 0; j < width; j++)
         mm[j] = 1;
+    }
+    for (j = 0; j < width; j++)
+      sum += mm[j];
+    switch (ELEMENT_TYPE)
+    {
+    case ELEM_INT64:
+      // back to front: element j overwrites ints 2j and 2j + 1, both >= j
+      for (j = width - 1; j >= 0; j--)
+        MELEM_AS(mat, m64, i, j) = mm[j];
+      break;
+    case ELEM_FLOAT:
+      for (j = 0; j < width; j++)
+        MELEM_AS(mat, mf, i, j) = (float)mm[j];
+      break;
+    case ELEM_DOUBLE:
+      for (j = width - 1; j >= 0; j--)
+        MELEM_AS(mat, md, i, j) = mm[j];
+      break;
+    }
+    if (VERIFY_MODE == VERIFY_CRC)
+      crc = crc32c(crc, (char *)mat->m + (size_t)i * mat->stride * ElementSize(ELEMENT_TYPE), rowBytes);
 #if OUTPUT
+    for (j = 0; j < width; j++)
       printf("matrix[%d][%d]=%d \n", i, j, mm[j]);
 #endif
-    }
   }
+  mat->sum = sum;
+  mat->crc = crc;
+}
+
+// CRC32C of the elements of mat, row by row
+uint32_t MatrixCrc(const Matrix *mat)
+{
+  size_t elemSize = ElementSize(ELEMENT_TYPE);
+  uint32_t crc = 0;
+  for (int i = 0; i < mat->rows; i++)
+    crc = crc32c(crc, (const char *)mat->m + (size_t)i * mat->stride * elemSize, mat->cols * elemSize);
+  return crc;
+}
+
+// Record the sum (and CRC with VERIFY_CRC) of a matrix GenMatrix() did not
+// fill, such as a view into a matrix file
+void StampMatrix(Matrix *mat)
+{
+  mat->sum = SumMatrix(mat);
+  mat->crc = VERIFY_MODE == VERIFY_CRC ? MatrixCrc(mat) : 0;
 }
 
 Matrix *GenMatrixRandom()
@@ -80,8 +179,9 @@ Matrix *GenMatrixRandom()
   int col;
   if (MATRIX_MODE == 0)
   {
-    row = 1 + rand() % 4;
-    col = 1 + rand() % 4;
+    Rng *rng = rng_thread();
+    row = rng_range(rng, 1, 4);
+    col = rng_range(rng, 1, 4);
   }
   else
   {
@@ -95,7 +195,12 @@ Matrix *GenMatrixRandom()
 
 Matrix *GenMatrixBySize(int row, int col)
 {
-  printf("Generate random matrix (RxC) = (%dx%d)\n", row, col);
+  if (LOG_ENABLED(LOG_ALL))
+  {
+    FILE *out = LogBegin();
+    fprintf(out, "Generate random matrix (RxC) = (%dx%d)\n", row, col);
+    LogEnd(out);
+  }
   Matrix *mat = AllocMatrix(row, col);
   GenMatrix(mat);
   return mat;
@@ -105,28 +210,20 @@ Matrix *MatrixMultiply(Matrix *m1, Matrix *m2)
 {
   if ((m1 == NULL) || (m2 == NULL))
     printf("m1=%p  m2=%p!\n", m1, m2);
-  int sum = 0;
   if (m1->cols != m2->rows)
   {
     return NULL;
   }
-  printf("MULTIPLY (%d x %d) BY (%d x %d):\n", m1->rows, m1->cols, m2->rows, m2->cols);
-  Matrix *newmat = AllocMatrix(m1->rows, m2->cols);
-  int **nm = newmat->m;
-  int **ma1 = m1->m;
-  int **ma2 = m2->m;
-  for (int c = 0; c < newmat->rows; c++)
+  if (LOG_ENABLED(LOG_PRODUCTS))
   {
-    for (int d = 0; d < newmat->cols; d++)
-    {
-      for (int k = 0; k < m2->rows; k++)
-      {
-        sum = sum + ma1[c][k] * ma2[k][d];
-      }
-      nm[c][d] = sum;
-      sum = 0;
-    }
+    FILE *out = LogBegin();
+    fprintf(out, "MULTIPLY (%d x %d) BY (%d x %d):\n", m1->rows, m1->cols, m2->rows, m2->cols);
+    LogEnd(out);
   }
+  Matrix *newmat = AllocMatrix(m1->rows, m2->cols);
+  // blocked / SIMD kernel picked at startup (mmkernel.c), large products
+  // are split across the helper threads (mmthreads.c)
+  MultiplyParallel(m1, m2, newmat);
   return newmat;
 }
 
@@ -137,22 +234,31 @@ void DisplayMatrix(Matrix *mat, FILE *stream)
     printf("DisplayMatrix: EMPTY matrix\n");
     return;
   }
-  int **matrix = mat->m;
   int height = mat->rows;
   int width = mat->cols;
-  int y = 0;
   int i, j;
   for (i = 0; i < height; i++)
   {
-    int *mm = matrix[i];
     fprintf(stream, "|");
     for (j = 0; j < width; j++)
     {
-      y = mm[j];
-      if (j == 0)
-        fprintf(stream, "%3d", y);
-      else
-        fprintf(stream, " %3d", y);
+      if (j > 0)
+        fprintf(stream, " ");
+      switch (ELEMENT_TYPE)
+      {
+      case ELEM_INT32:
+        fprintf(stream, "%3d", MELEM(mat, i, j));
+        break;
+      case ELEM_INT64:
+        fprintf(stream, "%3lld", (long long)MELEM_AS(mat, m64, i, j));
+        break;
+      case ELEM_FLOAT:
+        fprintf(stream, "%3g", MELEM_AS(mat, mf, i, j));
+        break;
+      case ELEM_DOUBLE:
+        fprintf(stream, "%3g", MELEM_AS(mat, md, i, j));
+        break;
+      }
     }
     fprintf(stream, "|\n");
   }
@@ -160,45 +266,44 @@ void DisplayMatrix(Matrix *mat, FILE *stream)
 
 int AvgElement(Matrix *mat) // int ** matrix, const int height, const int width)
 {
-  int **a = mat->m;
-  int height = mat->rows;
-  int width = mat->cols;
-  int x = 0;
-  int y = 0;
-  int ele = 0;
-  int i, j;
-  for (i = 0; i < height; i++)
-    for (j = 0; j < width; j++)
-    {
-      int *mm = a[i];
-      y = mm[j];
-      x = x + y;
-      ele++;
-#if OUTPUT
-      printf("[%d][%d]--%d x=%d ele=%d\n", i, j, mm[j], x, ele);
-#endif
-    }
-  printf("x=%d ele=%d\n", x, ele);
-  return x / ele;
+  int64_t x = SumMatrix(mat);
+  int ele = mat->rows * mat->cols;
+  printf("x=%lld ele=%d\n", (long long)x, ele);
+  return (int)(x / ele);
 }
 
-int SumMatrix(Matrix *mat)
-{
-  int **a = mat->m;
-  int height = mat->rows;
-  int width = mat->cols;
-  int i = 0;
-  int j = 0;
-  int y = 0;
-  int total = 0;
-  for (i = 0; i < height; i++)
-  {
-    for (j = 0; j < width; j++)
-    {
-      int *mm = a[i];
-      y = mm[j];
-      total = total + y;
-    }
+// Sum of an R x C matrix of type T with packed rows, in a 64-bit ACC,
+// unrolled for its element count
+#define SUM_SMALL(NAME, T, ACC, R, C)                               \
+  static int64_t sum_small_##NAME##R##C(const void *restrict mv)    \
+  {                                                                 \
+    const T *restrict m = (const T *)mv;                            \
+    ACC total = 0;                                                  \
+    _Pragma("GCC unroll 16") for (int i = 0; i < R * C; i++)        \
+      total += m[i];                                                \
+    return (int64_t)total;                                          \
   }
-  return total;
+#define SUM_SMALL_ROW(NAME, T, ACC, R) \
+  SUM_SMALL(NAME, T, ACC, R, 1) SUM_SMALL(NAME, T, ACC, R, 2) SUM_SMALL(NAME, T, ACC, R, 3) SUM_SMALL(NAME, T, ACC, R, 4)
+#define SUM_SMALL_ALL(NAME, T, ACC) \
+  SUM_SMALL_ROW(NAME, T, ACC, 1) SUM_SMALL_ROW(NAME, T, ACC, 2) SUM_SMALL_ROW(NAME, T, ACC, 3) SUM_SMALL_ROW(NAME, T, ACC, 4)
+SUM_SMALL_ALL(i32_, int32_t, int64_t)
+SUM_SMALL_ALL(i64_, int64_t, int64_t)
+SUM_SMALL_ALL(f32_, float, double)
+SUM_SMALL_ALL(f64_, double, double)
+
+// sumSmall[type][R - 1][C - 1], shapes up to MM_SMALL x MM_SMALL
+#define SUM_SMALL_ENTRY(NAME, R) {sum_small_##NAME##R##1, sum_small_##NAME##R##2, sum_small_##NAME##R##3, sum_small_##NAME##R##4}
+#define SUM_SMALL_TABLE(NAME) \
+  {SUM_SMALL_ENTRY(NAME, 1), SUM_SMALL_ENTRY(NAME, 2), SUM_SMALL_ENTRY(NAME, 3), SUM_SMALL_ENTRY(NAME, 4)}
+static int64_t (*const sumSmall[ELEM_TYPES][MM_SMALL][MM_SMALL])(const void *restrict) = {
+    SUM_SMALL_TABLE(i32_), SUM_SMALL_TABLE(i64_), SUM_SMALL_TABLE(f32_), SUM_SMALL_TABLE(f64_)};
+
+int64_t SumMatrix(Matrix *mat)
+{
+  if (mat->rows <= MM_SMALL && mat->cols <= MM_SMALL && mat->stride == mat->cols)
+    return sumSmall[ELEMENT_TYPE][mat->rows - 1][mat->cols - 1](mat->m);
+
+  // vectorized row reductions picked with the multiply kernel (mmkernel.c)
+  return SumRows(mat);
 }
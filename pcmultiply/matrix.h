@@ -7,25 +7,64 @@
  */
 
 #include <stdio.h> // added line
+#include <stdint.h>
 
 #define ROW 5
 #define COL 5
 
+// Matrices are a single cache-aligned block: the header below, padded out to
+// MATRIX_ALIGN bytes, followed directly by the elements in row-major order.
+// Element (i, j) lives at m[i * stride + j].
+#define MATRIX_ALIGN 64
+
+// ELEMENT TYPES
+// Every matrix of a run holds ELEMENT_TYPE elements (pcmatrix.h).  Sums are
+// 64-bit whatever the type; float and double elements are generated as
+// whole numbers, so their sums are exact too.
+#define ELEM_INT32 0
+#define ELEM_INT64 1
+#define ELEM_FLOAT 2
+#define ELEM_DOUBLE 3
+#define ELEM_TYPES 4
+
 typedef struct matrix {
   int rows;
   int cols;
-  int** m;
+  int stride; // number of elements between the starts of consecutive rows
+  union {     // row-major elements, stored in the same block as this header
+    int* m;        // ELEM_INT32
+    int64_t* m64;  // ELEM_INT64
+    float* mf;     // ELEM_FLOAT
+    double* md;    // ELEM_DOUBLE
+  };
+  uint64_t enqueued; // now_ns() when last put into the bounded buffer (BENCH_MODE)
+  int64_t sum;       // sum of the elements, recorded by the producer
+  uint32_t crc;      // CRC32C of the element bytes (VERIFY_CRC only)
 } Matrix;
 
+// Address of row i / element (i, j) of an int32 matrix
+#define MROW(mat, i) ((mat)->m + (size_t)(i) * (mat)->stride)
+#define MELEM(mat, i, j) (MROW(mat, i)[j])
+
+// The same through union member field (m, m64, mf or md), for any type
+#define MROW_AS(mat, field, i) ((mat)->field + (size_t)(i) * (mat)->stride)
+#define MELEM_AS(mat, field, i, j) (MROW_AS(mat, field, i)[j])
+
 //extern int theseed;
 
 // MATRIX ROUTINES
 Matrix* AllocMatrix(int r, int c);
+Matrix* AllocMatrixView(int r, int c, int* elems);
 void FreeMatrix(Matrix* mat);
 void GenMatrix(Matrix* mat);
 Matrix* GenMatrixRandom();
 int AvgElement(Matrix* mat);
-int SumMatrix(Matrix* mat);
+int64_t SumMatrix(Matrix* mat);
 Matrix* MatrixMultiply(Matrix* m1, Matrix* m2);
 void DisplayMatrix(Matrix* mat, FILE* stream);
 Matrix* GenMatrixBySize(int row, int col);
+void StampMatrix(Matrix* mat);
+uint32_t MatrixCrc(const Matrix* mat);
+int ElementParse(const char* name);
+const char* ElementName(int type);
+size_t ElementSize(int type);
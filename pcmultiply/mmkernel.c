@@ -0,0 +1,408 @@
+/*
+ *  mmkernel module
+ *  Matrix multiply and reduction kernels for every element type
+ *
+ *  All multiply kernels walk the product in i-k-j order over cache-sized
+ *  panels of the right-hand matrix so the innermost loop streams along rows
+ *  of both b and c.  The SIMD kernels keep a 4-row register tile of c in
+ *  vector registers while k runs over the panel.  The widest kernel the CPU
+ *  supports is picked at startup via CPUID; the scalar kernel is the
+ *  fallback, and also covers element types a SIMD tier has no kernel for
+ *  (int64 products: there is no packed 64-bit multiply below AVX-512).
+ *  Each kernel is stamped out once per element type by the macros below.
+ *
+ *  Products of small shapes, up to MM_SMALL in every dimension, skip all
+ *  of that: each (type, rows, inner, cols) has its own fully unrolled
+ *  kernel with the element count known at compile time.
+ *
+ *  Integer arithmetic is done modulo 2^32 / 2^64 (unsigned in C,
+ *  _mm*_mullo_epi32 / _mm*_add_epi32 in SIMD), so every kernel produces
+ *  bit-identical results to the straightforward triple loop regardless of
+ *  summation order.  float and double kernels multiply and add separately
+ *  (no FMA) in the same k order as the scalar loop, so they agree with it
+ *  bit for bit as well.
+ *
+ *  SumRows() reduces a matrix into 64 bits: int32 and int64 elements into
+ *  an int64, float and double elements into doubles, which are exact for
+ *  the whole-number elements this program makes.
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+// Include only libraries for this module
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <immintrin.h>
+#include "matrix.h"
+#include "mmkernel.h"
+#include "pcmatrix.h"
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+static void zero_rows(Matrix *c, int r0, int r1, size_t elemSize)
+{
+  for (int i = r0; i < r1; i++)
+    memset((char *)c->m + (size_t)i * c->stride * elemSize, 0, c->cols * elemSize);
+}
+
+// SCALAR KERNELS
+
+// c[i0..i1)[j0..j1) += a[i0..i1)[k0..k1) * b[k0..k1)[j0..j1), plain C on
+// union member FIELD with arithmetic type U
+#define MM_BLOCK_SCALAR(NAME, FIELD, U)                                              \
+  static void mm_block_scalar_##NAME(const Matrix *a, const Matrix *b, Matrix *c,    \
+                                     int i0, int i1, int j0, int j1, int k0, int k1) \
+  {                                                                                  \
+    for (int i = i0; i < i1; i++)                                                    \
+    {                                                                                \
+      U *ci = (U *)MROW_AS(c, FIELD, i);                                             \
+      for (int k = k0; k < k1; k++)                                                  \
+      {                                                                              \
+        U aik = (U)MELEM_AS(a, FIELD, i, k);                                         \
+        const U *bk = (const U *)MROW_AS(b, FIELD, k);                               \
+        for (int j = j0; j < j1; j++)                                                \
+          ci[j] += aik * bk[j];                                                      \
+      }                                                                              \
+    }                                                                                \
+  }                                                                                  \
+                                                                                     \
+  static void mm_kernel_scalar_##NAME(const Matrix *a, const Matrix *b, Matrix *c,   \
+                                      int r0, int r1)                                \
+  {                                                                                  \
+    int n = b->cols;                                                                 \
+    int kdim = a->cols;                                                              \
+    zero_rows(c, r0, r1, sizeof(U));                                                 \
+    for (int kk = 0; kk < kdim; kk += MM_KC)                                         \
+      for (int jj = 0; jj < n; jj += MM_NC)                                          \
+        mm_block_scalar_##NAME(a, b, c, r0, r1, jj, MIN(jj + MM_NC, n),              \
+                               kk, MIN(kk + MM_KC, kdim));                           \
+  }
+MM_BLOCK_SCALAR(i32, m, unsigned int)
+MM_BLOCK_SCALAR(i64, m64, uint64_t)
+MM_BLOCK_SCALAR(f32, mf, float)
+MM_BLOCK_SCALAR(f64, md, double)
+
+// SIMD KERNELS
+
+// 4 x 2W register tile of W-lane vectors V, then 1 x W for leftover rows,
+// and the scalar block of the same type (TYPE) for leftover columns.
+// LOAD/STORE/SET1/MADD are the vector operations for element type T
+// (MADD(t, a, b) = t + a * b).
+#define MM_KERNEL_SIMD(NAME, TYPE, TARGET, FIELD, T, V, W, LOAD, STORE, SET1, MADD)              \
+  __attribute__((target(TARGET))) static void mm_kernel_##NAME(const Matrix *a, const Matrix *b, \
+                                                               Matrix *c, int r0, int r1)        \
+  {                                                                                              \
+    int n = b->cols;                                                                             \
+    int kdim = a->cols;                                                                          \
+    zero_rows(c, r0, r1, sizeof(T));                                                             \
+    for (int kk = 0; kk < kdim; kk += MM_KC)                                                     \
+    {                                                                                            \
+      int kend = MIN(kk + MM_KC, kdim);                                                          \
+      for (int jj = 0; jj < n; jj += MM_NC)                                                      \
+      {                                                                                          \
+        int jend = MIN(jj + MM_NC, n);                                                           \
+        int i = r0;                                                                              \
+        for (; i + 4 <= r1; i += 4)                                                              \
+        {                                                                                        \
+          T *c0 = MROW_AS(c, FIELD, i), *c1 = MROW_AS(c, FIELD, i + 1);                          \
+          T *c2 = MROW_AS(c, FIELD, i + 2), *c3 = MROW_AS(c, FIELD, i + 3);                      \
+          int j = jj;                                                                            \
+          for (; j + 2 * W <= jend; j += 2 * W)                                                  \
+          {                                                                                      \
+            V t00 = LOAD(c0 + j), t01 = LOAD(c0 + j + W);                                        \
+            V t10 = LOAD(c1 + j), t11 = LOAD(c1 + j + W);                                        \
+            V t20 = LOAD(c2 + j), t21 = LOAD(c2 + j + W);                                        \
+            V t30 = LOAD(c3 + j), t31 = LOAD(c3 + j + W);                                        \
+            for (int k = kk; k < kend; k++)                                                      \
+            {                                                                                    \
+              const T *bk = MROW_AS(b, FIELD, k) + j;                                            \
+              V b0 = LOAD(bk);                                                                   \
+              V b1 = LOAD(bk + W);                                                               \
+              V a0 = SET1(MELEM_AS(a, FIELD, i, k));                                             \
+              V a1 = SET1(MELEM_AS(a, FIELD, i + 1, k));                                         \
+              V a2 = SET1(MELEM_AS(a, FIELD, i + 2, k));                                         \
+              V a3 = SET1(MELEM_AS(a, FIELD, i + 3, k));                                         \
+              t00 = MADD(t00, a0, b0);                                                           \
+              t01 = MADD(t01, a0, b1);                                                           \
+              t10 = MADD(t10, a1, b0);                                                           \
+              t11 = MADD(t11, a1, b1);                                                           \
+              t20 = MADD(t20, a2, b0);                                                           \
+              t21 = MADD(t21, a2, b1);                                                           \
+              t30 = MADD(t30, a3, b0);                                                           \
+              t31 = MADD(t31, a3, b1);                                                           \
+            }                                                                                    \
+            STORE(c0 + j, t00), STORE(c0 + j + W, t01);                                          \
+            STORE(c1 + j, t10), STORE(c1 + j + W, t11);                                          \
+            STORE(c2 + j, t20), STORE(c2 + j + W, t21);                                          \
+            STORE(c3 + j, t30), STORE(c3 + j + W, t31);                                          \
+          }                                                                                      \
+          mm_block_scalar_##TYPE(a, b, c, i, i + 4, j, jend, kk, kend);                          \
+        }                                                                                        \
+        for (; i < r1; i++)                                                                      \
+        {                                                                                        \
+          T *ci = MROW_AS(c, FIELD, i);                                                          \
+          int j = jj;                                                                            \
+          for (; j + W <= jend; j += W)                                                          \
+          {                                                                                      \
+            V t = LOAD(ci + j);                                                                  \
+            for (int k = kk; k < kend; k++)                                                      \
+              t = MADD(t, SET1(MELEM_AS(a, FIELD, i, k)), LOAD(MROW_AS(b, FIELD, k) + j));       \
+            STORE(ci + j, t);                                                                    \
+          }                                                                                      \
+          mm_block_scalar_##TYPE(a, b, c, i, i + 1, j, jend, kk, kend);                          \
+        }                                                                                        \
+      }                                                                                          \
+    }                                                                                            \
+  }
+
+// vector operations per element type: 128-bit (SSE) and 256-bit (AVX2)
+#define LOAD_I128(p) _mm_loadu_si128((const __m128i *)(p))
+#define STORE_I128(p, v) _mm_storeu_si128((__m128i *)(p), v)
+#define MADD_I32x4(t, a, b) _mm_add_epi32(t, _mm_mullo_epi32(a, b))
+#define MADD_F32x4(t, a, b) _mm_add_ps(t, _mm_mul_ps(a, b))
+#define MADD_F64x2(t, a, b) _mm_add_pd(t, _mm_mul_pd(a, b))
+#define LOAD_I256(p) _mm256_loadu_si256((const __m256i *)(p))
+#define STORE_I256(p, v) _mm256_storeu_si256((__m256i *)(p), v)
+#define MADD_I32x8(t, a, b) _mm256_add_epi32(t, _mm256_mullo_epi32(a, b))
+#define MADD_F32x8(t, a, b) _mm256_add_ps(t, _mm256_mul_ps(a, b))
+#define MADD_F64x4(t, a, b) _mm256_add_pd(t, _mm256_mul_pd(a, b))
+
+// SSE4.1: 4 x 8 int32 / 4 x 8 float / 4 x 4 double tiles
+MM_KERNEL_SIMD(sse41_i32, i32, "sse4.1", m, int, __m128i, 4, LOAD_I128, STORE_I128, _mm_set1_epi32, MADD_I32x4)
+MM_KERNEL_SIMD(sse41_f32, f32, "sse4.1", mf, float, __m128, 4, _mm_loadu_ps, _mm_storeu_ps, _mm_set1_ps, MADD_F32x4)
+MM_KERNEL_SIMD(sse41_f64, f64, "sse4.1", md, double, __m128d, 2, _mm_loadu_pd, _mm_storeu_pd, _mm_set1_pd, MADD_F64x2)
+
+// AVX2: 4 x 16 int32 / 4 x 16 float / 4 x 8 double tiles
+MM_KERNEL_SIMD(avx2_i32, i32, "avx2", m, int, __m256i, 8, LOAD_I256, STORE_I256, _mm256_set1_epi32, MADD_I32x8)
+MM_KERNEL_SIMD(avx2_f32, f32, "avx2", mf, float, __m256, 8, _mm256_loadu_ps, _mm256_storeu_ps, _mm256_set1_ps, MADD_F32x8)
+MM_KERNEL_SIMD(avx2_f64, f64, "avx2", md, double, __m256d, 4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_set1_pd, MADD_F64x4)
+
+// REDUCTIONS
+
+// Sum of all elements of m, accumulated in ACC and returned as int64
+#define SUM_ROWS_SCALAR(NAME, FIELD, ACC)                      \
+  static int64_t sum_rows_scalar_##NAME(const Matrix *m)       \
+  {                                                            \
+    ACC total = 0;                                             \
+    for (int i = 0; i < m->rows; i++)                          \
+    {                                                          \
+      const __typeof__(*m->FIELD) *row = MROW_AS(m, FIELD, i); \
+      for (int j = 0; j < m->cols; j++)                        \
+        total += row[j];                                       \
+    }                                                          \
+    return (int64_t)total;                                     \
+  }
+SUM_ROWS_SCALAR(i32, m, int64_t)
+SUM_ROWS_SCALAR(i64, m64, int64_t)
+SUM_ROWS_SCALAR(f32, mf, double)
+SUM_ROWS_SCALAR(f64, md, double)
+
+// The same W elements at a time: WIDEN(p) loads W elements and widens them
+// to the accumulator vector V, ADD adds two of those, HSUM folds one into a
+// scalar ACC.
+#define SUM_ROWS_SIMD(NAME, TARGET, FIELD, ACC, V, W, ZERO, WIDEN, ADD, HSUM)     \
+  __attribute__((target(TARGET))) static int64_t sum_rows_##NAME(const Matrix *m) \
+  {                                                                               \
+    V acc = ZERO();                                                               \
+    ACC total = 0;                                                                \
+    for (int i = 0; i < m->rows; i++)                                             \
+    {                                                                             \
+      const __typeof__(*m->FIELD) *row = MROW_AS(m, FIELD, i);                    \
+      int j = 0;                                                                  \
+      for (; j + W <= m->cols; j += W)                                            \
+        acc = ADD(acc, WIDEN(row + j));                                           \
+      for (; j < m->cols; j++)                                                    \
+        total += row[j];                                                          \
+    }                                                                             \
+    return (int64_t)(total + HSUM(acc));                                          \
+  }
+
+__attribute__((target("sse4.1"))) static inline int64_t hsum_i64x2(__m128i v)
+{
+  return _mm_cvtsi128_si64(v) + _mm_extract_epi64(v, 1);
+}
+
+__attribute__((target("avx2"))) static inline int64_t hsum_i64x4(__m256i v)
+{
+  __m128i s = _mm_add_epi64(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+  return _mm_cvtsi128_si64(s) + _mm_extract_epi64(s, 1);
+}
+
+__attribute__((target("avx2"))) static inline double hsum_f64x4(__m256d v)
+{
+  __m128d s = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+  return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+}
+
+#define WIDEN_I32x2(p) _mm_cvtepi32_epi64(_mm_loadl_epi64((const __m128i *)(p)))
+#define WIDEN_I32x4(p) _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i *)(p)))
+#define WIDEN_F32x4(p) _mm256_cvtps_pd(_mm_loadu_ps(p))
+
+SUM_ROWS_SIMD(sse41_i32, "sse4.1", m, int64_t, __m128i, 2, _mm_setzero_si128, WIDEN_I32x2, _mm_add_epi64, hsum_i64x2)
+SUM_ROWS_SIMD(avx2_i32, "avx2", m, int64_t, __m256i, 4, _mm256_setzero_si256, WIDEN_I32x4, _mm256_add_epi64, hsum_i64x4)
+SUM_ROWS_SIMD(avx2_i64, "avx2", m64, int64_t, __m256i, 4, _mm256_setzero_si256, LOAD_I256, _mm256_add_epi64, hsum_i64x4)
+SUM_ROWS_SIMD(avx2_f32, "avx2", mf, double, __m256d, 4, _mm256_setzero_pd, WIDEN_F32x4, _mm256_add_pd, hsum_f64x4)
+SUM_ROWS_SIMD(avx2_f64, "avx2", md, double, __m256d, 4, _mm256_setzero_pd, _mm256_loadu_pd, _mm256_add_pd, hsum_f64x4)
+
+// SMALL SHAPES
+
+// c = a * b for an R x K by K x C product of type U, rows packed
+// (stride == cols).  The bounds are constants, so the loops unroll completely.
+#define MM_SMALL_KERNEL(NAME, U, R, K, C)                       \
+  static void mm_small_##NAME##R##K##C(const void *restrict av, \
+                                       const void *restrict bv, \
+                                       void *restrict cv)       \
+  {                                                             \
+    const U *restrict a = (const U *)av;                        \
+    const U *restrict b = (const U *)bv;                        \
+    U *restrict c = (U *)cv;                                    \
+    _Pragma("GCC unroll 4") for (int i = 0; i < R; i++)         \
+    {                                                           \
+      _Pragma("GCC unroll 4") for (int j = 0; j < C; j++)       \
+      {                                                         \
+        U sum = 0;                                              \
+        _Pragma("GCC unroll 4") for (int k = 0; k < K; k++)     \
+          sum += a[i * K + k] * b[k * C + j];                   \
+        c[i * C + j] = sum;                                     \
+      }                                                         \
+    }                                                           \
+  }
+
+// one kernel per cols, per inner dimension, per rows, per type
+#define MM_SMALL_KERNELS_C(NAME, U, R, K)                             \
+  MM_SMALL_KERNEL(NAME, U, R, K, 1) MM_SMALL_KERNEL(NAME, U, R, K, 2) \
+  MM_SMALL_KERNEL(NAME, U, R, K, 3) MM_SMALL_KERNEL(NAME, U, R, K, 4)
+#define MM_SMALL_KERNELS_K(NAME, U, R)                                \
+  MM_SMALL_KERNELS_C(NAME, U, R, 1) MM_SMALL_KERNELS_C(NAME, U, R, 2) \
+  MM_SMALL_KERNELS_C(NAME, U, R, 3) MM_SMALL_KERNELS_C(NAME, U, R, 4)
+#define MM_SMALL_KERNELS(NAME, U)                               \
+  MM_SMALL_KERNELS_K(NAME, U, 1) MM_SMALL_KERNELS_K(NAME, U, 2) \
+  MM_SMALL_KERNELS_K(NAME, U, 3) MM_SMALL_KERNELS_K(NAME, U, 4)
+MM_SMALL_KERNELS(i32_, unsigned int)
+MM_SMALL_KERNELS(i64_, uint64_t)
+MM_SMALL_KERNELS(f32_, float)
+MM_SMALL_KERNELS(f64_, double)
+
+typedef void (*SmallKernel)(const void *restrict a, const void *restrict b, void *restrict c);
+
+// smallKernels[type][R - 1][K - 1][C - 1]
+#define MM_SMALL_ROW(NAME, R, K)                          \
+  {mm_small_##NAME##R##K##1, mm_small_##NAME##R##K##2,    \
+   mm_small_##NAME##R##K##3, mm_small_##NAME##R##K##4}
+#define MM_SMALL_PLANE(NAME, R)                           \
+  {MM_SMALL_ROW(NAME, R, 1), MM_SMALL_ROW(NAME, R, 2),    \
+   MM_SMALL_ROW(NAME, R, 3), MM_SMALL_ROW(NAME, R, 4)}
+#define MM_SMALL_TYPE(NAME)                               \
+  {MM_SMALL_PLANE(NAME, 1), MM_SMALL_PLANE(NAME, 2),      \
+   MM_SMALL_PLANE(NAME, 3), MM_SMALL_PLANE(NAME, 4)}
+static const SmallKernel smallKernels[ELEM_TYPES][MM_SMALL][MM_SMALL][MM_SMALL] = {
+    MM_SMALL_TYPE(i32_), MM_SMALL_TYPE(i64_), MM_SMALL_TYPE(f32_), MM_SMALL_TYPE(f64_)};
+
+// KERNEL SELECTION
+
+static const struct
+{
+  const char *name;
+  const char *cpu; // __builtin_cpu_supports feature, NULL for always available
+  MultiplyKernel fn[ELEM_TYPES]; // per element type, NULL - use the scalar one
+  SumKernel sum[ELEM_TYPES];
+} kernels[] = {
+    {"avx2", "avx2",
+     {mm_kernel_avx2_i32, NULL, mm_kernel_avx2_f32, mm_kernel_avx2_f64},
+     {sum_rows_avx2_i32, sum_rows_avx2_i64, sum_rows_avx2_f32, sum_rows_avx2_f64}},
+    {"sse4.1", "sse4.1",
+     {mm_kernel_sse41_i32, NULL, mm_kernel_sse41_f32, mm_kernel_sse41_f64},
+     {sum_rows_sse41_i32, NULL, NULL, NULL}},
+    {"scalar", NULL,
+     {mm_kernel_scalar_i32, mm_kernel_scalar_i64, mm_kernel_scalar_f32, mm_kernel_scalar_f64},
+     {sum_rows_scalar_i32, sum_rows_scalar_i64, sum_rows_scalar_f32, sum_rows_scalar_f64}},
+};
+#define NUM_KERNELS (int)(sizeof(kernels) / sizeof(kernels[0]))
+#define SCALAR_KERNEL (NUM_KERNELS - 1)
+
+static int kernelIndex = -1;
+static pthread_once_t kernelOnce = PTHREAD_ONCE_INIT;
+
+static int kernel_supported(int idx)
+{
+  if (kernels[idx].cpu == NULL)
+    return 1;
+  __builtin_cpu_init();
+  // __builtin_cpu_supports() needs a string literal
+  if (strcmp(kernels[idx].cpu, "avx2") == 0)
+    return __builtin_cpu_supports("avx2");
+  if (strcmp(kernels[idx].cpu, "sse4.1") == 0)
+    return __builtin_cpu_supports("sse4.1");
+  return 0;
+}
+
+static void select_best_kernel()
+{
+  if (kernelIndex >= 0)
+    return; // already chosen with SelectMultiplyKernel()
+  for (int i = 0; i < NUM_KERNELS; i++)
+  {
+    if (kernel_supported(i))
+    {
+      kernelIndex = i;
+      return;
+    }
+  }
+}
+
+// Force a kernel by name ("auto" picks the best one the CPU supports).
+// Returns -1 for unknown names or kernels this CPU cannot run.
+int SelectMultiplyKernel(const char *name)
+{
+  if (strcmp(name, "auto") == 0)
+  {
+    kernelIndex = -1;
+    select_best_kernel();
+    return 0;
+  }
+  for (int i = 0; i < NUM_KERNELS; i++)
+  {
+    if (strcmp(kernels[i].name, name) == 0)
+    {
+      if (!kernel_supported(i))
+        return -1;
+      kernelIndex = i;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+const char *MultiplyKernelName()
+{
+  pthread_once(&kernelOnce, select_best_kernel);
+  return kernels[kernelIndex].name;
+}
+
+void MultiplyRows(const Matrix *a, const Matrix *b, Matrix *c, int r0, int r1)
+{
+  // whole small product with packed rows: unrolled kernel for its shape
+  if (c->rows <= MM_SMALL && a->cols <= MM_SMALL && c->cols <= MM_SMALL && r0 == 0 && r1 == c->rows &&
+      a->stride == a->cols && b->stride == b->cols && c->stride == c->cols)
+  {
+    smallKernels[ELEMENT_TYPE][c->rows - 1][a->cols - 1][c->cols - 1](a->m, b->m, c->m);
+    return;
+  }
+
+  pthread_once(&kernelOnce, select_best_kernel);
+  MultiplyKernel fn = kernels[kernelIndex].fn[ELEMENT_TYPE];
+  if (fn == NULL)
+    fn = kernels[SCALAR_KERNEL].fn[ELEMENT_TYPE];
+  fn(a, b, c, r0, r1);
+}
+
+int64_t SumRows(const Matrix *mat)
+{
+  pthread_once(&kernelOnce, select_best_kernel);
+  SumKernel fn = kernels[kernelIndex].sum[ELEMENT_TYPE];
+  if (fn == NULL)
+    fn = kernels[SCALAR_KERNEL].sum[ELEMENT_TYPE];
+  return fn(mat);
+}
@@ -0,0 +1,30 @@
+/*
+ *  mmkernel header
+ *  Function prototypes and constants for the matrix multiply kernels
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+// Cache blocking: a KC x NC panel of the right-hand matrix (128 x 512
+// elements, 256 KiB of int32) is reused for every row of the left-hand
+// matrix before moving on
+#define MM_KC 128
+#define MM_NC 512
+
+// Shapes up to MM_SMALL x MM_SMALL (everything random mode makes) are
+// multiplied by fully unrolled kernels, one per (rows, inner, cols)
+#define MM_SMALL 4
+
+// Computes rows [r0, r1) of c = a * b.  All three matrices must already have
+// matching dimensions; only the selected rows of c are written.
+typedef void (*MultiplyKernel)(const Matrix *a, const Matrix *b, Matrix *c, int r0, int r1);
+
+// Sum of all elements of a matrix, widened to 64 bits
+typedef int64_t (*SumKernel)(const Matrix *m);
+
+// KERNEL ROUTINES
+void MultiplyRows(const Matrix *a, const Matrix *b, Matrix *c, int r0, int r1);
+int64_t SumRows(const Matrix *mat);
+int SelectMultiplyKernel(const char *name);
+const char *MultiplyKernelName();
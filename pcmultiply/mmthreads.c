@@ -0,0 +1,187 @@
+/*
+ *  mmthreads module
+ *  Helper thread pool that splits one large product across cores
+ *
+ *  With big MATRIX_MODE sizes a single MatrixMultiply() takes far longer
+ *  than anything else in the pipeline and would run on one consumer while
+ *  the rest of the machine idles.  MultiplyParallel() cuts the rows of the
+ *  result into blocks and posts the product as a job.  The helper threads
+ *  and the calling consumer all claim blocks and run MultiplyRows() on them
+ *  until none are left.  The caller then waits for the last block to finish.
+ *
+ *  Several consumers may post products at once; helpers serve the oldest
+ *  job that still has unclaimed blocks.  A job lives on its caller's stack
+ *  and is unlinked as soon as its last block is claimed, so a helper never
+ *  touches a job after the caller has been told it is done.
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+// Include only libraries for this module
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "matrix.h"
+#include "mmkernel.h"
+#include "mmthreads.h"
+
+// One product being computed
+typedef struct mmjob
+{
+  const Matrix *a, *b;
+  Matrix *c;
+  int nextRow;   // first row not yet claimed
+  int blockRows; // rows per claimed block
+  int rowsDone;  // rows computed so far
+  struct mmjob *next;
+} MMJob;
+
+static pthread_mutex_t jobLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t jobPosted = PTHREAD_COND_INITIALIZER; // helpers wait here
+static pthread_cond_t jobDone = PTHREAD_COND_INITIALIZER;   // callers wait here
+static MMJob *jobsHead, *jobsTail; // jobs with unclaimed rows, oldest first
+static int stopping;
+
+static pthread_t *helpers;
+static int numHelpers;
+
+// Claim the next block of job under jobLock, unlinking the job once its
+// last block is gone.  Returns the number of rows claimed, 0 if none left.
+static int claim_block(MMJob *job, int *r0)
+{
+  int n = job->c->rows - job->nextRow;
+  if (n <= 0)
+    return 0;
+  if (n > job->blockRows)
+    n = job->blockRows;
+  *r0 = job->nextRow;
+  job->nextRow += n;
+
+  if (job->nextRow == job->c->rows)
+  {
+    // fully claimed, stop offering it to helpers
+    MMJob **pp = &jobsHead;
+    MMJob *prev = NULL;
+    while (*pp != NULL && *pp != job)
+    {
+      prev = *pp;
+      pp = &(*pp)->next;
+    }
+    if (*pp == job)
+    {
+      *pp = job->next;
+      if (jobsTail == job)
+        jobsTail = prev;
+    }
+  }
+  return n;
+}
+
+// Compute rows [r0, r0 + n) of job, then report them under jobLock
+static void run_block(MMJob *job, int r0, int n)
+{
+  MultiplyRows(job->a, job->b, job->c, r0, r0 + n);
+
+  pthread_mutex_lock(&jobLock);
+  job->rowsDone += n;
+  if (job->rowsDone == job->c->rows)
+    pthread_cond_broadcast(&jobDone);
+  pthread_mutex_unlock(&jobLock);
+}
+
+static void *helper_main(void *arg)
+{
+  (void)arg;
+  pthread_mutex_lock(&jobLock);
+  for (;;)
+  {
+    while (jobsHead == NULL && !stopping)
+      pthread_cond_wait(&jobPosted, &jobLock);
+    if (jobsHead == NULL)
+      break;
+
+    MMJob *job = jobsHead;
+    int r0;
+    int n = claim_block(job, &r0);
+    pthread_mutex_unlock(&jobLock);
+    run_block(job, r0, n);
+    pthread_mutex_lock(&jobLock);
+  }
+  pthread_mutex_unlock(&jobLock);
+  return NULL;
+}
+
+// Start nthreads helpers.  With 0 every product stays on its caller.
+void MultiplyThreadsStart(int nthreads)
+{
+  if (nthreads <= 0)
+    return;
+  stopping = 0;
+  helpers = (pthread_t *)malloc(sizeof(pthread_t) * nthreads);
+  for (numHelpers = 0; numHelpers < nthreads; numHelpers++)
+  {
+    if (pthread_create(&helpers[numHelpers], NULL, helper_main, NULL) != 0)
+      break;
+  }
+}
+
+// Stop and join the helpers, once no products are being computed
+void MultiplyThreadsStop()
+{
+  if (numHelpers == 0)
+    return;
+  pthread_mutex_lock(&jobLock);
+  stopping = 1;
+  pthread_cond_broadcast(&jobPosted);
+  pthread_mutex_unlock(&jobLock);
+  for (int i = 0; i < numHelpers; i++)
+    pthread_join(helpers[i], NULL);
+  free(helpers);
+  helpers = NULL;
+  numHelpers = 0;
+}
+
+// c = a * b, shared with the helper threads when the product is big enough
+void MultiplyParallel(const Matrix *a, const Matrix *b, Matrix *c)
+{
+  long work = (long)a->rows * a->cols * b->cols;
+  if (numHelpers == 0 || c->rows < 2 || work < MM_PAR_MIN_WORK)
+  {
+    MultiplyRows(a, b, c, 0, c->rows);
+    return;
+  }
+
+  MMJob job;
+  job.a = a;
+  job.b = b;
+  job.c = c;
+  job.nextRow = 0;
+  job.blockRows = c->rows / ((numHelpers + 1) * MM_PAR_BLOCKS_PER_THREAD);
+  if (job.blockRows < 1)
+    job.blockRows = 1;
+  job.rowsDone = 0;
+  job.next = NULL;
+
+  pthread_mutex_lock(&jobLock);
+  if (jobsTail != NULL)
+    jobsTail->next = &job;
+  else
+    jobsHead = &job;
+  jobsTail = &job;
+  pthread_cond_broadcast(&jobPosted);
+
+  // work on our own product alongside the helpers
+  int r0, n;
+  while ((n = claim_block(&job, &r0)) > 0)
+  {
+    pthread_mutex_unlock(&jobLock);
+    run_block(&job, r0, n);
+    pthread_mutex_lock(&jobLock);
+  }
+
+  // the last blocks may still be running on helpers
+  while (job.rowsDone < c->rows)
+    pthread_cond_wait(&jobDone, &jobLock);
+  pthread_mutex_unlock(&jobLock);
+}
@@ -0,0 +1,20 @@
+/*
+ *  mmthreads header
+ *  Function prototypes, data, and constants for the parallel multiply module
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+// Products needing fewer multiply-adds than this (128 x 128 x 128) stay on
+// the calling thread, handing them out costs more than it saves
+#define MM_PAR_MIN_WORK (128L * 128 * 128)
+
+// Each product is cut into about this many row blocks per thread working on
+// it, so threads that finish early pick up the slack
+#define MM_PAR_BLOCKS_PER_THREAD 4
+
+// MULTIPLY THREAD ROUTINES
+void MultiplyThreadsStart(int nthreads);
+void MultiplyThreadsStop();
+void MultiplyParallel(const Matrix *a, const Matrix *b, Matrix *c);
@@ -18,7 +18,9 @@
  *  - the total number of matrices consumed (matrixtotal from each consumer thread)
  *  - the sum of all elements of all matrices produced and consumed (sumtotal from each producer and consumer thread)
  *
- *  Then, these values from each thread are aggregated in main thread for output
+ *  Then, these values from each thread are aggregated in main thread for output.
+ *  With --stats the threads also time their condition waits, lock hold,
+ *  generation and multiplication, printed per thread after the summary.
  *
  *  Correct programs will produce and consume the same number of matrices, and
  *  report the same sum for all matrix elements produced and consumed.
@@ -34,132 +36,779 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
 #include <pthread.h>
 #include <assert.h>
 #include <time.h>
+#include <signal.h>
+#include <unistd.h>
 #include "matrix.h"
+#include "mmkernel.h"
+#include "mmthreads.h"
+#include "pool.h"
+#include "logger.h"
 #include "counter.h"
+#include "hist.h"
+#include "waitq.h"
+#include "steal.h"
+#include "rng.h"
+#include "matfile.h"
+#include "sink.h"
+#include "affinity.h"
+#include "pipeline.h"
 #include "prodcons.h"
 #include "pcmatrix.h"
 
-int main(int argc, char *argv[])
+static void usage(const char *prog)
 {
-  // Process command line arguments
-  int numw = NUMWORK;
-  if (argc == 1)
+  fprintf(stderr, "usage: %s [options] [worker_threads [bounded_buffer_size [matricies [matrix_mode]]]]\n", prog);
+  fprintf(stderr, "  -e, --element=int32|int64|float|double\n");
+  fprintf(stderr, "                                matrix element type (default int32)\n");
+  fprintf(stderr, "  -V, --verify=trust|sum|crc32c how consumers check matrices against the producer (default trust)\n");
+  fprintf(stderr, "  -b, --buffer=mutex|lockfree|sharded|routed\n");
+  fprintf(stderr, "                                bounded buffer engine (default mutex)\n");
+  fprintf(stderr, "  -w, --wait=futex|cond         mutex buffer waits on futex wait queues or condition variables (default futex)\n");
+  fprintf(stderr, "  -K, --shards=K                rings in the sharded buffer (default %d)\n", DEFAULT_NUM_SHARDS);
+  fprintf(stderr, "  -P, --producers=N             producer threads (default worker_threads)\n");
+  fprintf(stderr, "  -C, --consumers=N             consumer threads (default worker_threads)\n");
+  fprintf(stderr, "  -a, --affinity=none|compact|scatter|paired\n");
+  fprintf(stderr, "                                pin workers to CPUs (default none)\n");
+  fprintf(stderr, "  -W, --steal                   consumers queue pairs and idle ones steal from peers\n");
+  fprintf(stderr, "      --steal-depth=N           pairs each consumer keeps queued for peers to steal (default %d)\n", DEFAULT_STEAL_DEPTH);
+  fprintf(stderr, "  -L, --pipeline=PAIR,MULT,REDUCE\n");
+  fprintf(stderr, "                                staged consumers, threads per stage (replaces --consumers)\n");
+  fprintf(stderr, "  -n, --batch=N                 matrices moved per buffer operation (default 1)\n");
+  fprintf(stderr, "  -c, --counter=mutex|atomic|sharded\n");
+  fprintf(stderr, "                                synchronized counter implementation (default atomic)\n");
+  fprintf(stderr, "  -v, --verbose=0|1|2           0 quiet, 1 products only, 2 everything (default 2)\n");
+  fprintf(stderr, "  -q, --quiet                   same as --verbose=0\n");
+  fprintf(stderr, "  -l, --log=sync|async          write output directly or from a logger thread (default sync)\n");
+  fprintf(stderr, "  -s, --seed=N                  random seed, repeat a run exactly (default: time)\n");
+  fprintf(stderr, "  -m, --match                   pair every consumed matrix with a compatible pending one\n");
+  fprintf(stderr, "  -p, --pool                    recycle matrices through per-thread pools\n");
+  fprintf(stderr, "  -k, --kernel=auto|avx2|sse4.1|scalar\n");
+  fprintf(stderr, "                                multiply kernel (default auto, best the CPU supports)\n");
+  fprintf(stderr, "  -i, --input=FILE              replay matrices from FILE instead of generating them\n");
+  fprintf(stderr, "      --make-input=FILE         write the matrices a run would generate to FILE and exit\n");
+  fprintf(stderr, "  -o, --output=FILE             write every product to FILE from a writer thread\n");
+  fprintf(stderr, "      --output-factors          write m1 and m2 with every product\n");
+  fprintf(stderr, "  -t, --mult-threads=N          helper threads that split large products (default 0)\n");
+  fprintf(stderr, "  -T, --duration=SECONDS        stop producing after SECONDS, drain and report (Ctrl-C does the same)\n");
+  fprintf(stderr, "  -B, --bench=csv|json          time put/get and buffer residency, end with one record\n");
+  fprintf(stderr, "  -S, --stats                   print where each worker spent its time\n");
+}
+
+static void print_latency(const char *name, const Hist *h)
+{
+  printf("  %-10s n=%llu mean=%.0f p50=%llu p99=%llu p999=%llu max=%llu\n", name,
+         (unsigned long long)h->count, hist_mean(h),
+         (unsigned long long)hist_percentile(h, 0.50), (unsigned long long)hist_percentile(h, 0.99),
+         (unsigned long long)hist_percentile(h, 0.999), (unsigned long long)(h->count ? h->max : 0));
+}
+
+// Threads in each stage with PIPELINE_MODE
+static int stageThreads[STAGES];
+
+// The --pipeline stage sizes for the bench record, "off" without it
+static const char *pipeline_spec()
+{
+  static char spec[48];
+  if (!PIPELINE_MODE)
+    return "off";
+  snprintf(spec, sizeof(spec), "%d+%d+%d", stageThreads[STAGE_PAIR], stageThreads[STAGE_MULTIPLY], stageThreads[STAGE_REDUCE]);
+  return spec;
+}
+
+// One line of the STATS_MODE breakdown, times in milliseconds
+static void print_thread_stats(const char *who, int id, const ProdConsStats *s)
+{
+  if (id < 0)
+    printf("  %-6s", who);
+  else
+    printf("  %s %-3d", who, id);
+  printf(" full_wait=%.3f empty_wait=%.3f lock_hold=%.3f gen=%.3f mult=%.3f"
+         " locks=%d waits=%d spurious=%d discarded=%d stolen=%d stolen_live=%d"
+         " spin_wins=%d parks=%d wakes=%d wakes_skipped=%d\n",
+         s->fullWait / 1e6, s->emptyWait / 1e6, s->lockHold / 1e6, s->genTime / 1e6, s->multTime / 1e6,
+         s->lockAcquires, s->condWaits, s->spuriousWakeups, s->discarded, s->stolen, s->stolenLive,
+         s->wait.spinWins, s->wait.parks, s->wait.wakes, s->wait.skipped);
+}
+
+// SIGINT, SIGTERM and the --duration alarm end production early; the
+// workers then drain the buffer and the run reports as usual
+static void stop_handler(int sig)
+{
+  stopProduction();
+}
+
+// Thread attributes pinning a worker to cpu, or defaults for cpu -1
+static void worker_attr(pthread_attr_t *attr, int cpu)
+{
+  pthread_attr_init(attr);
+  if (cpu < 0)
+    return;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  pthread_attr_setaffinity_np(attr, sizeof(set), &set);
+}
+
+// Print the percentile columns of one histogram as CSV or JSON
+static void print_latency_fields(const char *name, const Hist *h, int header)
+{
+  static const char *suffix[] = {"p50_ns", "p99_ns", "p999_ns", "max_ns"};
+  unsigned long long v[] = {hist_percentile(h, 0.50), hist_percentile(h, 0.99),
+                            hist_percentile(h, 0.999), h->count ? h->max : 0};
+  for (int i = 0; i < 4; i++)
   {
+    if (BENCH_MODE == BENCH_JSON)
+      printf(",\"%s_%s\":%llu", name, suffix[i], v[i]);
+    else if (header)
+      printf(",%s_%s", name, suffix[i]);
+    else
+      printf(",%llu", v[i]);
+  }
+}
 
-    MAX_BOUNDED_BUFFER_SIZE = MAX;
-    NUMBER_OF_MATRICES = LOOPS;
-    MATRIX_MODE = DEFAULT_MATRIX_MODE;
-    printf("USING DEFAULTS: worker_threads=%d bounded_buffer_size=%d matricies=%d matrix_mode=%d\n", numw, MAX_BOUNDED_BUFFER_SIZE, NUMBER_OF_MATRICES, MATRIX_MODE);
+// One machine-readable record of this run for bench.sh
+static void print_bench_record(int nprod, int ncons, double elapsed, const ProdConsStats *prod, const ProdConsStats *cons)
+{
+  static const char *engine[] = {"mutex", "lockfree", "sharded", "routed"};
+  double rate = elapsed > 0 ? cons->matrixtotal / elapsed : 0.0;
+  static const char *verify[] = {"trust", "sum", "crc32c"};
+  int ok = prod->sumtotal == cons->sumtotal && prod->matrixtotal == cons->matrixtotal && cons->corrupt == 0;
+
+  if (BENCH_MODE == BENCH_JSON)
+  {
+    printf("{\"producers\":%d,\"consumers\":%d,\"buffer\":%d,\"matrices\":%d,\"mode\":%d,\"element\":\"%s\",\"verify\":\"%s\",\"engine\":\"%s\","
+           "\"batch\":%d,\"counter\":\"%s\",\"match\":%d,\"steal\":%d,\"pipeline\":\"%s\",\"mult_threads\":%d,\"pool\":%d,\"kernel\":\"%s\",\"affinity\":\"%s\",\"seed\":%llu,"
+           "\"elapsed_s\":%.6f,\"matrices_per_sec\":%.0f,\"multiplied\":%d,\"check\":\"%s\"",
+           nprod, ncons, MAX_BOUNDED_BUFFER_SIZE, NUMBER_OF_MATRICES, MATRIX_MODE, ElementName(ELEMENT_TYPE), verify[VERIFY_MODE], engine[BUFFER_MODE], BATCH_SIZE,
+           cnt_mode_name(COUNTER_MODE), MATCH_MODE, STEAL_MODE, pipeline_spec(), MULT_THREADS, MATRIX_POOL, MultiplyKernelName(), PlacementName(PLACEMENT), RNG_SEED,
+           elapsed, rate, cons->multtotal, ok ? "ok" : "MISMATCH");
+    print_latency_fields("residency", &cons->residency, 0);
+    print_latency_fields("put_wait", &prod->putWait, 0);
+    print_latency_fields("get_wait", &cons->getWait, 0);
+    printf("}\n");
+    return;
   }
-  else
+
+  printf("producers,consumers,buffer,matrices,mode,element,verify,engine,batch,counter,match,steal,pipeline,mult_threads,pool,kernel,affinity,seed,"
+         "elapsed_s,matrices_per_sec,multiplied,check");
+  print_latency_fields("residency", &cons->residency, 1);
+  print_latency_fields("put_wait", &prod->putWait, 1);
+  print_latency_fields("get_wait", &cons->getWait, 1);
+  printf("\n");
+  printf("%d,%d,%d,%d,%d,%s,%s,%s,%d,%s,%d,%d,%s,%d,%d,%s,%s,%llu,%.6f,%.0f,%d,%s",
+         nprod, ncons, MAX_BOUNDED_BUFFER_SIZE, NUMBER_OF_MATRICES, MATRIX_MODE, ElementName(ELEMENT_TYPE), verify[VERIFY_MODE], engine[BUFFER_MODE], BATCH_SIZE,
+         cnt_mode_name(COUNTER_MODE), MATCH_MODE, STEAL_MODE, pipeline_spec(), MULT_THREADS, MATRIX_POOL, MultiplyKernelName(), PlacementName(PLACEMENT), RNG_SEED,
+         elapsed, rate, cons->multtotal, ok ? "ok" : "MISMATCH");
+  print_latency_fields("residency", &cons->residency, 0);
+  print_latency_fields("put_wait", &prod->putWait, 0);
+  print_latency_fields("get_wait", &cons->getWait, 0);
+  printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+  // Process command line options
+  static struct option long_options[] = {
+      {"element", required_argument, NULL, 'e'},
+      {"verify", required_argument, NULL, 'V'},
+      {"buffer", required_argument, NULL, 'b'},
+      {"wait", required_argument, NULL, 'w'},
+      {"shards", required_argument, NULL, 'K'},
+      {"kernel", required_argument, NULL, 'k'},
+      {"mult-threads", required_argument, NULL, 't'},
+      {"pool", no_argument, NULL, 'p'},
+      {"batch", required_argument, NULL, 'n'},
+      {"producers", required_argument, NULL, 'P'},
+      {"consumers", required_argument, NULL, 'C'},
+      {"steal", no_argument, NULL, 'W'},
+      {"steal-depth", required_argument, NULL, 'D'},
+      {"affinity", required_argument, NULL, 'a'},
+      {"pipeline", required_argument, NULL, 'L'},
+      {"counter", required_argument, NULL, 'c'},
+      {"match", no_argument, NULL, 'm'},
+      {"verbose", required_argument, NULL, 'v'},
+      {"quiet", no_argument, NULL, 'q'},
+      {"log", required_argument, NULL, 'l'},
+      {"seed", required_argument, NULL, 's'},
+      {"input", required_argument, NULL, 'i'},
+      {"make-input", required_argument, NULL, 'I'},
+      {"output", required_argument, NULL, 'o'},
+      {"output-factors", no_argument, NULL, 'F'},
+      {"duration", required_argument, NULL, 'T'},
+      {"bench", required_argument, NULL, 'B'},
+      {"stats", no_argument, NULL, 'S'},
+      {"help", no_argument, NULL, 'h'},
+      {NULL, 0, NULL, 0}};
+
+  ELEMENT_TYPE = DEFAULT_ELEMENT_TYPE;
+  VERIFY_MODE = DEFAULT_VERIFY_MODE;
+  BUFFER_MODE = DEFAULT_BUFFER_MODE;
+  WAIT_MODE = DEFAULT_WAIT_MODE;
+  NUM_SHARDS = DEFAULT_NUM_SHARDS;
+  MATRIX_POOL = DEFAULT_MATRIX_POOL;
+  BATCH_SIZE = DEFAULT_BATCH_SIZE;
+  COUNTER_MODE = DEFAULT_COUNTER_MODE;
+  MATCH_MODE = DEFAULT_MATCH_MODE;
+  VERBOSITY = DEFAULT_VERBOSITY;
+  LOG_ASYNC = DEFAULT_LOG_ASYNC;
+  BENCH_MODE = DEFAULT_BENCH_MODE;
+  STATS_MODE = DEFAULT_STATS_MODE;
+  STEAL_MODE = DEFAULT_STEAL_MODE;
+  STEAL_DEPTH = DEFAULT_STEAL_DEPTH;
+  MULT_THREADS = DEFAULT_MULT_THREADS;
+  PLACEMENT = DEFAULT_PLACEMENT;
+  PIPELINE_MODE = DEFAULT_PIPELINE_MODE;
+  int nprod = 0; // 0 - same as worker_threads
+  int ncons = 0;
+  int seedGiven = 0;
+  int duration = 0; // 0 - run until every matrix is made
+  const char *inputPath = NULL;
+  const char *makeInputPath = NULL;
+  const char *outputPath = NULL;
+  int outputFactors = 0;
+  int opt;
+  while ((opt = getopt_long(argc, argv, "e:V:b:w:K:k:i:o:t:pn:P:C:WL:a:c:mv:ql:s:T:B:Sh", long_options, NULL)) != -1)
   {
-    if (argc == 2)
+    switch (opt)
     {
-      numw = atoi(argv[1]);
-      MAX_BOUNDED_BUFFER_SIZE = MAX;
-      NUMBER_OF_MATRICES = LOOPS;
-      MATRIX_MODE = DEFAULT_MATRIX_MODE;
+    case 'e':
+      ELEMENT_TYPE = ElementParse(optarg);
+      if (ELEMENT_TYPE < 0)
+      {
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 'V':
+      if (strcmp(optarg, "trust") == 0)
+        VERIFY_MODE = VERIFY_TRUST;
+      else if (strcmp(optarg, "sum") == 0)
+        VERIFY_MODE = VERIFY_SUM;
+      else if (strcmp(optarg, "crc32c") == 0)
+        VERIFY_MODE = VERIFY_CRC;
+      else
+      {
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 'b':
+      if (strcmp(optarg, "mutex") == 0)
+        BUFFER_MODE = BUFFER_MUTEX;
+      else if (strcmp(optarg, "lockfree") == 0)
+        BUFFER_MODE = BUFFER_LOCKFREE;
+      else if (strcmp(optarg, "sharded") == 0)
+        BUFFER_MODE = BUFFER_SHARDED;
+      else if (strcmp(optarg, "routed") == 0)
+        BUFFER_MODE = BUFFER_ROUTED;
+      else
+      {
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 'w':
+      if (strcmp(optarg, "futex") == 0)
+        WAIT_MODE = WAIT_FUTEX;
+      else if (strcmp(optarg, "cond") == 0)
+        WAIT_MODE = WAIT_COND;
+      else
+      {
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 'K':
+      NUM_SHARDS = atoi(optarg);
+      if (NUM_SHARDS < 1)
+      {
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 'k':
+      if (SelectMultiplyKernel(optarg) != 0)
+      {
+        fprintf(stderr, "Multiply kernel '%s' is unknown or not supported by this CPU\n", optarg);
+        return 1;
+      }
+      break;
+    case 't':
+      MULT_THREADS = atoi(optarg);
+      if (MULT_THREADS < 0)
+      {
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 'p':
+      MATRIX_POOL = 1;
+      break;
+    case 'n':
+      BATCH_SIZE = atoi(optarg);
+      if (BATCH_SIZE < 1)
+      {
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 'P':
+      nprod = atoi(optarg);
+      if (nprod < 1)
+      {
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 'C':
+      ncons = atoi(optarg);
+      if (ncons < 1)
+      {
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 'W':
+      STEAL_MODE = 1;
+      break;
+    case 'D':
+      STEAL_DEPTH = atoi(optarg);
+      if (STEAL_DEPTH < 1)
+      {
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 'L':
+      if (StageParse(optarg, stageThreads) != 0)
+      {
+        usage(argv[0]);
+        return 1;
+      }
+      PIPELINE_MODE = 1;
+      break;
+    case 'a':
+      PLACEMENT = PlacementParse(optarg);
+      if (PLACEMENT < 0)
+      {
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 'm':
+      MATCH_MODE = 1;
+      break;
+    case 'v':
+      VERBOSITY = atoi(optarg);
+      if (VERBOSITY < LOG_QUIET || VERBOSITY > LOG_ALL)
+      {
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 's':
+      RNG_SEED = strtoull(optarg, NULL, 0);
+      seedGiven = 1;
+      break;
+    case 'i':
+      inputPath = optarg;
+      break;
+    case 'I':
+      makeInputPath = optarg;
+      break;
+    case 'o':
+      outputPath = optarg;
+      break;
+    case 'F':
+      outputFactors = 1;
+      break;
+    case 'q':
+      VERBOSITY = LOG_QUIET;
+      break;
+    case 'l':
+      if (strcmp(optarg, "sync") == 0)
+        LOG_ASYNC = 0;
+      else if (strcmp(optarg, "async") == 0)
+        LOG_ASYNC = 1;
+      else
+      {
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 'B':
+      if (strcmp(optarg, "csv") == 0)
+        BENCH_MODE = BENCH_CSV;
+      else if (strcmp(optarg, "json") == 0)
+        BENCH_MODE = BENCH_JSON;
+      else
+      {
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 'T':
+      duration = atoi(optarg);
+      if (duration < 1)
+      {
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 'S':
+      STATS_MODE = 1;
+      break;
+    case 'c':
+      if (strcmp(optarg, "mutex") == 0)
+        COUNTER_MODE = COUNTER_MUTEX;
+      else if (strcmp(optarg, "atomic") == 0)
+        COUNTER_MODE = COUNTER_ATOMIC;
+      else if (strcmp(optarg, "sharded") == 0)
+        COUNTER_MODE = COUNTER_SHARDED;
+      else
+      {
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    default:
+      usage(argv[0]);
+      return opt == 'h' ? 0 : 1;
     }
-    if (argc == 3)
-    {
-      numw = atoi(argv[1]);
-      MAX_BOUNDED_BUFFER_SIZE = atoi(argv[2]);
-      NUMBER_OF_MATRICES = LOOPS;
-      MATRIX_MODE = DEFAULT_MATRIX_MODE;
-    }
-    if (argc == 4)
-    {
-      numw = atoi(argv[1]);
-      MAX_BOUNDED_BUFFER_SIZE = atoi(argv[2]);
-      NUMBER_OF_MATRICES = atoi(argv[3]);
-      MATRIX_MODE = DEFAULT_MATRIX_MODE;
-    }
-    if (argc == 5)
+  }
+
+  // Process positional arguments
+  int nargs = argc - optind;
+  char **args = argv + optind;
+  int numw = NUMWORK;
+  MAX_BOUNDED_BUFFER_SIZE = MAX;
+  NUMBER_OF_MATRICES = LOOPS;
+  MATRIX_MODE = DEFAULT_MATRIX_MODE;
+  if (nargs >= 1)
+    numw = atoi(args[0]);
+  if (nargs >= 2)
+    MAX_BOUNDED_BUFFER_SIZE = atoi(args[1]);
+  if (nargs >= 3)
+    NUMBER_OF_MATRICES = atoi(args[2]);
+  if (nargs >= 4)
+    MATRIX_MODE = atoi(args[3]);
+  if (nargs == 0)
+    printf("USING DEFAULTS: worker_threads=%d bounded_buffer_size=%d matricies=%d matrix_mode=%d\n", numw, MAX_BOUNDED_BUFFER_SIZE, NUMBER_OF_MATRICES, MATRIX_MODE);
+  else
+    printf("USING: worker_threads=%d bounded_buffer_size=%d matricies=%d matrix_mode=%d\n", numw, MAX_BOUNDED_BUFFER_SIZE, NUMBER_OF_MATRICES, MATRIX_MODE);
+
+  if (nprod == 0)
+    nprod = numw;
+  if (ncons == 0)
+    ncons = numw;
+  if (PIPELINE_MODE)
+  {
+    if (STEAL_MODE)
     {
-      numw = atoi(argv[1]);
-      MAX_BOUNDED_BUFFER_SIZE = atoi(argv[2]);
-      NUMBER_OF_MATRICES = atoi(argv[3]);
-      MATRIX_MODE = atoi(argv[4]);
+      fprintf(stderr, "--pipeline has its own multiply stage, it cannot be used with --steal\n");
+      return 1;
     }
-    printf("USING: worker_threads=%d bounded_buffer_size=%d matricies=%d matrix_mode=%d\n", numw, MAX_BOUNDED_BUFFER_SIZE, NUMBER_OF_MATRICES, MATRIX_MODE);
+    // every consumer thread runs one stage
+    ncons = stageThreads[STAGE_PAIR] + stageThreads[STAGE_MULTIPLY] + stageThreads[STAGE_REDUCE];
   }
 
-  time_t t;
-  // Seed the random number generator with the system time
-  srand((unsigned)time(&t));
+  if (!seedGiven)
+  {
+    // Seed the random number generator with the system time
+    RNG_SEED = (unsigned long long)time(NULL);
+  }
 
-  Matrix **buffer = initBoundedBuffer();
+  if (ELEMENT_TYPE != ELEM_INT32 && (inputPath != NULL || makeInputPath != NULL || outputPath != NULL))
+  {
+    fprintf(stderr, "Matrix files hold int32 elements, --element=%s cannot be used with them\n", ElementName(ELEMENT_TYPE));
+    return 1;
+  }
+
+  if (makeInputPath != NULL)
+  {
+    // the same matrices a single producer would make with this seed
+    rng_thread_seed(RNG_SEED, 0);
+    if (matfile_write(makeInputPath, NUMBER_OF_MATRICES) != 0)
+      return 1;
+    printf("Wrote %d matrices in mode %d to %s (seed %llu)\n", NUMBER_OF_MATRICES, MATRIX_MODE, makeInputPath, RNG_SEED);
+    return 0;
+  }
+
+  MatFile input;
+  if (inputPath != NULL)
+  {
+    if (matfile_open(&input, inputPath) != 0)
+      return 1;
+    matrixInput = &input;
+    // replay the whole file unless a matrix count was given
+    if (nargs < 3)
+      NUMBER_OF_MATRICES = input.count;
+  }
+
+  if (outputPath != NULL && SinkStart(outputPath, outputFactors) != 0)
+    return 1;
+
+  if (initBoundedBuffer() == NULL)
+  {
+    fprintf(stderr, "Could not allocate a bounded buffer of %d matrices\n", MAX_BOUNDED_BUFFER_SIZE);
+    return 1;
+  }
+  if (STEAL_MODE)
+  {
+    // a consumer refills while its deque is below STEAL_DEPTH, so one more
+    // batch worth of pairs always fits on top
+    stealPool = steal_create(ncons, STEAL_DEPTH + BATCH_SIZE);
+  }
+  StageQueue stageQueues[2];
+  if (PIPELINE_MODE)
+  {
+    // each queue between stages holds as much as the bounded buffer, so a
+    // slow stage backs up into the one before it
+    stage_init(&stageQueues[0], MAX_BOUNDED_BUFFER_SIZE);
+    stage_init(&stageQueues[1], MAX_BOUNDED_BUFFER_SIZE);
+    pairQueue = &stageQueues[0];
+    productQueue = &stageQueues[1];
+  }
 
   // Got help in debugging and chatgpt said to use this.
   counters_t *counter = (counters_t *)malloc(sizeof(counters_t));
-  counter->prod = (counter_t *)malloc(sizeof(counter_t));
-  counter->cons = (counter_t *)malloc(sizeof(counter_t));
+  counter->prod = (counter_t *)aligned_alloc(COUNTER_CACHE_LINE, sizeof(counter_t));
+  counter->cons = (counter_t *)aligned_alloc(COUNTER_CACHE_LINE, sizeof(counter_t));
 
   init_cnt(counter->prod);
   init_cnt(counter->cons);
 
-  printf("Producing %d matrices in mode %d.\n", NUMBER_OF_MATRICES, MATRIX_MODE);
+  if (matrixInput != NULL)
+    printf("Replaying %d matrices from %s (%d in file).\n", NUMBER_OF_MATRICES, inputPath, input.count);
+  else
+    printf("Producing %d matrices in mode %d.\n", NUMBER_OF_MATRICES, MATRIX_MODE);
+  printf("Elements: %s, 64-bit sums\n", ElementName(ELEMENT_TYPE));
+  printf("Verify: %s\n", VERIFY_MODE == VERIFY_TRUST ? "trust sums recorded by producers"
+                          : VERIFY_MODE == VERIFY_SUM ? "consumers re-sum every matrix"
+                                                      : "consumers check a CRC32C of every matrix");
   printf("Using a shared buffer of size=%d\n", MAX_BOUNDED_BUFFER_SIZE);
-  printf("With %d producer and consumer thread(s).\n", numw);
+  if (BUFFER_MODE == BUFFER_SHARDED)
+    printf("Buffer engine: %d mutex shards, batch size=%d\n", NUM_SHARDS < MAX_BOUNDED_BUFFER_SIZE ? NUM_SHARDS : MAX_BOUNDED_BUFFER_SIZE, BATCH_SIZE);
+  else if (BUFFER_MODE == BUFFER_ROUTED)
+    printf("Buffer engine: per-rows queues, batch size=%d\n", BATCH_SIZE);
+  else
+    printf("Buffer engine: %s, batch size=%d\n", BUFFER_MODE == BUFFER_LOCKFREE ? "lock-free ring"
+                                         : WAIT_MODE == WAIT_FUTEX ? "mutex + futex wait queues"
+                                                                   : "mutex + condition variables",
+           BATCH_SIZE);
+  printf("Multiply kernel: %s, %d helper thread(s) for large products\n", MultiplyKernelName(), MULT_THREADS);
+  printf("Counters: %s\n", cnt_mode_name(COUNTER_MODE));
+  printf("Pairing: %s%s\n", MATCH_MODE ? "matching index" : "discard until compatible",
+         STEAL_MODE ? ", work-stealing consumers" : "");
+  if (STEAL_MODE)
+    printf("Steal depth: %d pairs per consumer\n", STEAL_DEPTH);
+  if (PIPELINE_MODE)
+    printf("Pipeline: %d pair, %d multiply, %d reduce thread(s), stage queues of %d\n", stageThreads[STAGE_PAIR],
+           stageThreads[STAGE_MULTIPLY], stageThreads[STAGE_REDUCE], MAX_BOUNDED_BUFFER_SIZE);
+  printf("Random seed: %llu\n", RNG_SEED);
+  printf("Output: verbosity=%d, %s\n", VERBOSITY, LOG_ASYNC ? "async logger thread" : "synchronous");
+  printf("Matrix pool: %s\n", MATRIX_POOL ? "per-thread size classes" : "off (malloc/free)");
+  if (outputPath != NULL)
+    printf("Results: %s to %s\n", outputFactors ? "m1, m2 and m3" : "products", outputPath);
+  printf("With %d producer and %d consumer thread(s).\n", nprod, ncons);
+
+  // Pick a CPU for every worker before any of them exist
+  int prodCpu[nprod];
+  int consCpu[ncons];
+  PlacementPlan(PLACEMENT, nprod, ncons, prodCpu, consCpu);
+  printf("Placement: %s\n", PlacementName(PLACEMENT));
+  if (PLACEMENT != PLACE_NONE)
+  {
+    for (int i = 0; i < nprod; i++)
+      printf("  producer %-3d cpu %-3d node %d\n", i, prodCpu[i], CpuNode(prodCpu[i]));
+    for (int i = 0; i < ncons; i++)
+      printf("  consumer %-3d cpu %-3d node %d\n", i, consCpu[i], CpuNode(consCpu[i]));
+  }
   printf("\n");
 
-  pthread_t prodWorkerThreads[numw];
-  pthread_t consWorkerThreads[numw];
+  LogStart(LOG_ASYNC);
+  MultiplyThreadsStart(MULT_THREADS);
+
+  struct timespec start, finish;
+  clock_gettime(CLOCK_MONOTONIC, &start);
 
-  for (int i = 0; i < numw; i++)
+  pthread_t prodWorkerThreads[nprod];
+  pthread_t consWorkerThreads[ncons];
+  int consStage[ncons]; // STAGE_* each consumer runs (PIPELINE_MODE)
+
+  WorkerArgs prodArgs[nprod];
+  WorkerArgs consArgs[ncons];
+
+  // a second Ctrl-C kills the program outright
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = stop_handler;
+  sa.sa_flags = SA_RESTART | SA_RESETHAND;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  sa.sa_flags = SA_RESTART;
+  sigaction(SIGALRM, &sa, NULL);
+  if (duration > 0)
+    alarm(duration);
+
+  // Create specified number of producer and consumer threads, each started
+  // on its CPU so its first allocations already land on that node
+  for (int i = 0; i < nprod; i++)
   {
-    // Create specified number of producer and consumer threads
-    pthread_create(&prodWorkerThreads[i], NULL, prod_worker, counter->prod);
-    pthread_create(&consWorkerThreads[i], NULL, cons_worker, counter->cons);
+    prodArgs[i] = (WorkerArgs){.counter = counter->prod, .id = i, .nworkers = nprod, .stage = 0}; // producers come before every stage
+    pthread_attr_t attr;
+    worker_attr(&attr, prodCpu[i]);
+    pthread_create(&prodWorkerThreads[i], &attr, prod_worker, &prodArgs[i]);
+    pthread_attr_destroy(&attr);
+  }
+  for (int i = 0; i < ncons; i++)
+  {
+    consArgs[i] = (WorkerArgs){.counter = counter->cons, .id = i, .nworkers = ncons, .stage = STAGE_PAIR};
+    consStage[i] = STAGE_PAIR;
+    if (PIPELINE_MODE)
+    {
+      // consumers are numbered through the stages in order, id and
+      // nworkers count within the consumer's own stage
+      int first = 0;
+      int stage = 0;
+      while (i >= first + stageThreads[stage])
+        first += stageThreads[stage++];
+      consArgs[i] = (WorkerArgs){.counter = counter->cons, .id = i - first, .nworkers = stageThreads[stage], .stage = stage};
+      consStage[i] = stage;
+    }
+    pthread_attr_t attr;
+    worker_attr(&attr, consCpu[i]);
+    pthread_create(&consWorkerThreads[i], &attr, cons_worker, &consArgs[i]);
+    pthread_attr_destroy(&attr);
   }
 
   ProdConsStats *totalProdStats = (ProdConsStats *)malloc(sizeof(ProdConsStats));
   ProdConsStats *totalConsStats = (ProdConsStats *)malloc(sizeof(ProdConsStats));
+  init_stats(totalProdStats);
+  init_stats(totalConsStats);
 
-  ProdConsStats *prodStats;
-  ProdConsStats *consStats;
-  for (int i = 0; i < numw; i++)
+  // kept until after the summary for the per-thread STATS_MODE breakdown
+  ProdConsStats *prodStats[nprod];
+  ProdConsStats *consStats[ncons];
+  for (int i = 0; i < nprod; i++)
+  {
+    // wait for each thread to finish, aggregate stats from each thread
+    pthread_join(prodWorkerThreads[i], (void **)&prodStats[i]);
+    add_stats(totalProdStats, prodStats[i]);
+  }
+  alarm(0);
+  for (int i = 0; i < ncons; i++)
   {
-    // wait for each thread to finish
-    pthread_join(prodWorkerThreads[i], (void **)&prodStats);
-    pthread_join(consWorkerThreads[i], (void **)&consStats);
+    pthread_join(consWorkerThreads[i], (void **)&consStats[i]);
+    add_stats(totalConsStats, consStats[i]);
+  }
 
-    // Aggregate stats from each thread
-    totalProdStats->matrixtotal += prodStats->matrixtotal;
-    totalProdStats->sumtotal += prodStats->sumtotal;
-    totalProdStats->multtotal += prodStats->multtotal;
+  // every consumer has returned, nothing is left for the helpers
+  MultiplyThreadsStop();
 
-    totalConsStats->matrixtotal += consStats->matrixtotal;
-    totalConsStats->sumtotal += consStats->sumtotal;
-    totalConsStats->multtotal += consStats->multtotal;
-  }
-  free(consStats);
-  free(prodStats);
+  // every consumer has flushed its staged results, drain the writer
+  long written = 0;
+  uint64_t checksum = 0;
+  if (outputPath != NULL)
+    SinkStop(&written, &checksum);
+
+  // flush per-matrix output before the summary
+  LogShutdown();
+
+  clock_gettime(CLOCK_MONOTONIC, &finish);
+  double elapsed = (finish.tv_sec - start.tv_sec) + (finish.tv_nsec - start.tv_nsec) / 1e9;
 
   int prs = totalProdStats->matrixtotal;   // total # of matrices produced
   int cos = totalConsStats->matrixtotal;   // total # of matrices consumed
-  int prodtot = totalProdStats->sumtotal;  // total sum of elements for matrices produced
-  int constot = totalConsStats->sumtotal;  // total sum of elements for matrices consumed
+  long long prodtot = totalProdStats->sumtotal; // total sum of elements for matrices produced
+  long long constot = totalConsStats->sumtotal; // total sum of elements for matrices consumed
   int consmul = totalConsStats->multtotal; // total # multiplications
 
   // consume ProdConsStats from producer and consumer threads [HINT: return from join]
   // add up total matrix stats in prs, cos, prodtot, constot, consmul
-  printf("Sum of Matrix elements --> Produced=%d = Consumed=%d\n", prodtot, constot);
+  printf("Sum of Matrix elements --> Produced=%lld = Consumed=%lld\n", prodtot, constot);
   printf("Matrices produced=%d consumed=%d multiplied=%d\n", prs, cos, consmul);
+  printf("Counters produced=%d consumed=%d\n", get_cnt(counter->prod), get_cnt(counter->cons));
+  if (productionStopped())
+    printf("Stopped early: produced %d of %d matrices\n", prs, NUMBER_OF_MATRICES);
+  if (prs != cos)
+    printf("ERROR: %d matrices were left in the buffer\n", prs - cos);
+  if (VERIFY_MODE != VERIFY_TRUST)
+    printf("Verified %d matrices by %s, corrupt=%d\n", cos, VERIFY_MODE == VERIFY_SUM ? "sum" : "crc32c",
+           totalConsStats->corrupt);
+  if (PIPELINE_MODE)
+  {
+    // full waits point at a slow stage downstream of the queue, empty
+    // waits at a slow one upstream
+    printf("Stage queues: pairs full_waits=%d empty_waits=%d, products full_waits=%d empty_waits=%d\n",
+           pairQueue->fullWaits, pairQueue->emptyWaits, productQueue->fullWaits, productQueue->emptyWaits);
+  }
+  printf("Multiplications per consumed matrix=%.3f (at most 0.5)\n", cos > 0 ? (double)consmul / cos : 0.0);
+  if (MATRIX_POOL)
+  {
+    PoolStats ps;
+    GetPoolStats(&ps);
+    long allocs = ps.hits + ps.misses + ps.oversize;
+    printf("Matrix pool: allocs=%ld hits=%ld misses=%ld oversize=%ld hit_rate=%.1f%% local_frees=%ld remote_frees=%ld pools=%d\n",
+           allocs, ps.hits, ps.misses, ps.oversize, allocs > 0 ? 100.0 * ps.hits / allocs : 0.0,
+           ps.localFrees, ps.remoteFrees, ps.pools);
+  }
+  if (outputPath != NULL)
+    printf("Results written=%ld checksum=%llu to %s\n", written, (unsigned long long)checksum, outputPath);
+  printf("Elapsed=%.3fs Throughput=%.0f matrices/sec\n", elapsed, elapsed > 0 ? cos / elapsed : 0.0);
+  if (STATS_MODE)
+  {
+    printf("Worker time (ms):\n");
+    for (int i = 0; i < nprod; i++)
+      print_thread_stats("prod", i, prodStats[i]);
+    for (int i = 0; i < ncons; i++)
+      print_thread_stats(PIPELINE_MODE ? StageName(consStage[i]) : "cons", PIPELINE_MODE ? consArgs[i].id : i, consStats[i]);
+    print_thread_stats("prod", -1, totalProdStats);
+    print_thread_stats("cons", -1, totalConsStats);
+  }
+  if (BENCH_MODE)
+  {
+    printf("Latency (ns):\n");
+    print_latency("residency", &totalConsStats->residency);
+    print_latency("put", &totalProdStats->putWait);
+    print_latency("get", &totalConsStats->getWait);
+    print_bench_record(nprod, ncons, elapsed, totalProdStats, totalConsStats);
+  }
 
-  free(buffer);
+  destroyBoundedBuffer();
+  if (matrixInput != NULL)
+    matfile_close(matrixInput);
+  if (STEAL_MODE)
+    steal_destroy(stealPool);
+  if (PIPELINE_MODE)
+  {
+    stage_destroy(pairQueue);
+    stage_destroy(productQueue);
+  }
 
   // free ProdConsStats
+  for (int i = 0; i < nprod; i++)
+    free(prodStats[i]);
+  for (int i = 0; i < ncons; i++)
+    free(consStats[i]);
   free(totalProdStats);
   free(totalConsStats);
 
   // free counters
+  destroy_cnt(counter->prod);
+  destroy_cnt(counter->cons);
   free(counter->prod);
   free(counter->cons);
   free(counter);
 
+  // release pooled matrix blocks
+  if (MATRIX_POOL)
+    PoolShutdown();
+
   return 0;
 }
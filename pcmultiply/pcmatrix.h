@@ -6,7 +6,8 @@
  *  TCSS 422 - Operating Systems
  */
 
-// Number of worker threads - NUMWORK producers, NUMWORK consumers
+// Number of worker threads - NUMWORK producers, NUMWORK consumers unless
+// --producers/--consumers say otherwise
 #define NUMWORK 1
 
 // Constant for enabling and disabling DEBUG output
@@ -25,3 +26,131 @@ int NUMBER_OF_MATRICES;
 // mode 1-n - Specifies a fixed number of rows and cols with matrix elements of 1
 #define DEFAULT_MATRIX_MODE 0
 int MATRIX_MODE;
+
+// VERIFY MODE FLAG
+// Producers record every matrix's sum in its header (GenMatrix()).
+// VERIFY_TRUST - consumers add up the recorded sums, no second pass
+// VERIFY_SUM   - consumers re-sum every matrix and count mismatches
+// VERIFY_CRC   - producers also record a CRC32C of the elements, consumers
+//                recompute it and count mismatches
+#define VERIFY_TRUST 0
+#define VERIFY_SUM 1
+#define VERIFY_CRC 2
+#define DEFAULT_VERIFY_MODE VERIFY_TRUST
+int VERIFY_MODE;
+
+// ELEMENT TYPE FLAG
+// Type of every matrix element, one of the ELEM_* types in matrix.h
+#define DEFAULT_ELEMENT_TYPE ELEM_INT32
+int ELEMENT_TYPE;
+
+// BUFFER MODE FLAG
+// mode 0 - ring guarded by one mutex and two condition variables
+// mode 1 - lock-free multi-producer/multi-consumer ring with futex parking
+// mode 2 - NUM_SHARDS rings with a mutex each (shardbuf.c)
+// mode 3 - one queue per matrix row count, consumers ask for the rows they
+//          need (route.c)
+#define BUFFER_MUTEX 0
+#define BUFFER_LOCKFREE 1
+#define BUFFER_SHARDED 2
+#define BUFFER_ROUTED 3
+#define DEFAULT_BUFFER_MODE BUFFER_MUTEX
+int BUFFER_MODE;
+
+// WAIT MODE FLAG (BUFFER_MUTEX)
+// WAIT_FUTEX - spin-then-park futex wait queues with waiter counts, one
+//              targeted wakeup per notify and none when nobody waits (waitq.c)
+// WAIT_COND  - the original pthread condition variables
+#define WAIT_FUTEX 0
+#define WAIT_COND 1
+#define DEFAULT_WAIT_MODE WAIT_FUTEX
+int WAIT_MODE;
+
+// Number of rings the bounded buffer is split into (BUFFER_SHARDED)
+#define DEFAULT_NUM_SHARDS 4
+int NUM_SHARDS;
+
+// MATRIX POOL FLAG
+// 0 - matrices come straight from malloc/free
+// 1 - matrices are recycled through per-thread size-class pools (pool.c)
+#define DEFAULT_MATRIX_POOL 0
+int MATRIX_POOL;
+
+// Number of matrices moved per put_batch()/get_batch() call
+#define DEFAULT_BATCH_SIZE 1
+int BATCH_SIZE;
+
+// Helper threads that share the rows of large products with the consumer
+// computing them (mmthreads.c), 0 - every product stays on one consumer
+#define DEFAULT_MULT_THREADS 0
+int MULT_THREADS;
+
+// COUNTER MODE FLAG (see counter.h)
+// COUNTER_MUTEX, COUNTER_ATOMIC or COUNTER_SHARDED
+#define DEFAULT_COUNTER_MODE 1
+int COUNTER_MODE;
+
+// MATCH MODE FLAG
+// 0 - consumers hold m1 and discard matrices until one fits as m2
+// 1 - consumers pair every matrix with a compatible pending one (match.c)
+#define DEFAULT_MATCH_MODE 0
+int MATCH_MODE;
+
+// STEAL MODE FLAG
+// 0 - each consumer multiplies the pairs it finds itself
+// 1 - consumers queue pairs on their own deque and idle consumers steal
+//     from their peers (steal.c)
+#define DEFAULT_STEAL_MODE 0
+int STEAL_MODE;
+
+// Pairs each consumer keeps queued on its deque for peers to steal
+// (STEAL_MODE), independent of BATCH_SIZE
+#define DEFAULT_STEAL_DEPTH 8
+int STEAL_DEPTH;
+
+// PIPELINE MODE FLAG
+// 0 - every consumer pairs, multiplies and reduces the matrices it takes
+// 1 - consumers are split into pair, multiply and reduce stages connected
+//     by bounded queues, each stage with its own thread count (pipeline.c)
+#define DEFAULT_PIPELINE_MODE 0
+int PIPELINE_MODE;
+
+// VERBOSITY LEVEL (see logger.h)
+// 0 - quiet, 1 - products only, 2 - everything
+#define DEFAULT_VERBOSITY 2
+int VERBOSITY;
+
+// LOG MODE FLAG
+// 0 - workers write to stdout directly (serialized with flockfile)
+// 1 - workers queue formatted text for a dedicated logger thread
+#define DEFAULT_LOG_ASYNC 0
+int LOG_ASYNC;
+
+// RANDOM SEED
+// Producer i draws from stream i of this seed (rng.c).  Defaults to the time.
+unsigned long long RNG_SEED;
+
+
+// BENCH MODE FLAG
+// BENCH_OFF  - no timing beyond the elapsed time and throughput
+// BENCH_CSV  - time every put()/get() and how long each matrix sat in the
+// BENCH_JSON   buffer, and end with one CSV or JSON record of throughput and
+//              latency percentiles (see bench.sh)
+#define BENCH_OFF 0
+#define BENCH_CSV 1
+#define BENCH_JSON 2
+#define DEFAULT_BENCH_MODE BENCH_OFF
+int BENCH_MODE;
+
+// STATS MODE FLAG
+// 0 - only the totals every run prints
+// 1 - also time lock hold, condition waits, generation and multiplication
+//     per thread and print the breakdown after the summary
+#define DEFAULT_STATS_MODE 0
+int STATS_MODE;
+
+// PLACEMENT FLAG
+// CPU pinning policy for the workers, one of the PLACE_* policies in
+// affinity.h; PLACE_NONE leaves them to the scheduler
+#define DEFAULT_PLACEMENT 0
+int PLACEMENT;
@@ -0,0 +1,167 @@
+/*
+ *  pipeline module
+ *  Bounded queues that connect the stages of the pipelined consumer
+ *
+ *  In the pipeline every consumer thread does one job.  Pairing threads
+ *  take matrices off the bounded buffer and queue pairs, multiply threads
+ *  turn pairs into products, and reduce threads display, write out and
+ *  free the products.  Each stage is sized on its own, so the threads can
+ *  go to whichever stage is slowest.
+ *
+ *  The queues are bounded, so backpressure travels upstream.  A slow reduce
+ *  stage fills the product queue, which parks the multipliers.  The pair
+ *  queue then fills and parks the pairers, the bounded buffer fills, and
+ *  the producers park.  End of stream travels downstream the same way the
+ *  producers close the bounded buffer: every thread of a stage calls
+ *  stage_leave() on the queue it feeds when its input has drained, and the
+ *  last one closes it.
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+// Include only libraries for this module
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "matrix.h"
+#include "waitq.h"
+#include "pipeline.h"
+
+static const char *stageNames[] = {"pair", "multiply", "reduce"};
+
+int stage_init(StageQueue *q, int capacity)
+{
+  assert(capacity > 0);
+  q->items = (StageItem *)malloc(sizeof(StageItem) * capacity);
+  if (q->items == NULL)
+    return -1;
+  pthread_mutex_init(&q->lock, NULL);
+  q->capacity = capacity;
+  q->head = 0;
+  q->tail = 0;
+  q->count = 0;
+  q->closed = 0;
+  q->fullWaits = 0;
+  q->emptyWaits = 0;
+  waitq_init(&q->notFull);
+  waitq_init(&q->notEmpty);
+  atomic_init(&q->exited, 0);
+  return 0;
+}
+
+void stage_destroy(StageQueue *q)
+{
+  pthread_mutex_destroy(&q->lock);
+  free(q->items);
+  q->items = NULL;
+}
+
+// Queue n items, blocking while the queue is full.  Whatever fits goes in
+// under one lock acquisition.
+void stage_put_batch(StageQueue *q, const StageItem *items, int n)
+{
+  int done = 0;
+  while (done < n)
+  {
+    pthread_mutex_lock(&q->lock);
+    while (q->count == q->capacity)
+    {
+      // the ticket is taken under the lock, so a get after we let go
+      // moves the word on and the wait cannot miss it
+      q->fullWaits++;
+      unsigned int ticket = waitq_prepare(&q->notFull);
+      pthread_mutex_unlock(&q->lock);
+      waitq_wait(&q->notFull, ticket);
+      pthread_mutex_lock(&q->lock);
+    }
+
+    int added = 0;
+    while (done < n && q->count < q->capacity)
+    {
+      q->items[q->head] = items[done++];
+      q->head = (q->head + 1) % q->capacity;
+      q->count++;
+      added++;
+    }
+    pthread_mutex_unlock(&q->lock);
+    waitq_notify(&q->notEmpty, added);
+  }
+}
+
+// Dequeue up to max items, blocking while the queue is empty.  Returns 0
+// once the queue is closed and drained.
+int stage_get_batch(StageQueue *q, StageItem *items, int max)
+{
+  pthread_mutex_lock(&q->lock);
+  while (q->count == 0)
+  {
+    if (q->closed)
+    {
+      pthread_mutex_unlock(&q->lock);
+      return 0;
+    }
+    q->emptyWaits++;
+    unsigned int ticket = waitq_prepare(&q->notEmpty);
+    pthread_mutex_unlock(&q->lock);
+    waitq_wait(&q->notEmpty, ticket);
+    pthread_mutex_lock(&q->lock);
+  }
+
+  int count = 0;
+  while (count < max && q->count > 0)
+  {
+    items[count++] = q->items[q->tail];
+    q->tail = (q->tail + 1) % q->capacity;
+    q->count--;
+  }
+  pthread_mutex_unlock(&q->lock);
+  waitq_notify(&q->notFull, count);
+  return count;
+}
+
+// One of the nworkers upstream threads is done putting.  The last one
+// closes the queue and wakes every parked downstream thread.
+void stage_leave(StageQueue *q, int nworkers)
+{
+  if (atomic_fetch_add(&q->exited, 1) + 1 != nworkers)
+    return;
+  pthread_mutex_lock(&q->lock);
+  q->closed = 1;
+  pthread_mutex_unlock(&q->lock);
+  waitq_notify_all(&q->notEmpty);
+}
+
+// Parse "PAIR,MULTIPLY,REDUCE" thread counts, each at least 1.  Returns 0,
+// or -1 and leaves counts alone if spec is malformed.
+int StageParse(const char *spec, int counts[STAGES])
+{
+  int parsed[STAGES];
+  const char *p = spec;
+  for (int i = 0; i < STAGES; i++)
+  {
+    char *end;
+    long v = strtol(p, &end, 10);
+    if (end == p || v < 1 || v > 4096)
+      return -1;
+    parsed[i] = (int)v;
+    if (i < STAGES - 1)
+    {
+      if (*end != ',')
+        return -1;
+      p = end + 1;
+    }
+    else if (*end != '\0')
+    {
+      return -1;
+    }
+  }
+  memcpy(counts, parsed, sizeof(parsed));
+  return 0;
+}
+
+const char *StageName(int stage)
+{
+  return stageNames[stage];
+}
@@ -0,0 +1,52 @@
+/*
+ *  pipeline header
+ *  Function prototypes, data, and constants for the pipeline stage queues
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+// Pipeline stages after the producers, in the order work flows through them
+#define STAGE_PAIR 0     // take matrices off the bounded buffer and pair them
+#define STAGE_MULTIPLY 1 // multiply pairs
+#define STAGE_REDUCE 2   // display, write out and free products, count them
+#define STAGES 3
+
+// One unit of work between stages: m1 x m2, and m3 once it is multiplied
+typedef struct stageitem
+{
+  Matrix *m1;
+  Matrix *m2;
+  Matrix *m3;
+} StageItem;
+
+// Bounded queue between two stages.  One mutex around a ring, threads wait
+// for room or items on futex wait queues (waitq.c).  The upstream stage
+// counts its threads out with stage_leave(), the last one closes the queue.
+typedef struct stagequeue
+{
+  pthread_mutex_t lock;
+  StageItem *items;
+  int capacity;
+  int head; // next slot to fill
+  int tail; // next slot to empty
+  int count;
+  int closed;
+  int fullWaits;  // puts that found the queue full, the downstream stage is slower
+  int emptyWaits; // gets that found it empty, the upstream stage is slower
+  WaitQ notFull;
+  WaitQ notEmpty;
+  atomic_int exited; // upstream threads that have left
+} StageQueue;
+
+// STAGE QUEUE ROUTINES
+int stage_init(StageQueue *q, int capacity);
+void stage_destroy(StageQueue *q);
+void stage_put_batch(StageQueue *q, const StageItem *items, int n);
+int stage_get_batch(StageQueue *q, StageItem *items, int max);
+void stage_leave(StageQueue *q, int nworkers);
+int StageParse(const char *spec, int counts[STAGES]);
+const char *StageName(int stage);
@@ -0,0 +1,193 @@
+/*
+ *  pool module
+ *  Per-thread size-class allocator for matrix blocks
+ *
+ *  Producers allocate every matrix and consumers free them, so with plain
+ *  malloc/free nearly every block crosses threads.  Here a consumer pushes
+ *  a freed block back onto its producer's remote stack and the producer
+ *  reuses it on a later allocation, so steady state runs without malloc.
+ *
+ *  The remote stacks are only ever pushed by other threads and drained
+ *  whole by the owner with atomic_exchange, which keeps them free of ABA.
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+// Include only libraries for this module
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <assert.h>
+#include "pool.h"
+
+// Prefix size, rounded so the caller's block stays POOL_ALIGN aligned
+#define POOL_PREFIX ((sizeof(PoolBlock) + POOL_ALIGN - 1) / POOL_ALIGN * POOL_ALIGN)
+
+// Registry of all pools, so stats can be summed and memory released
+static MatrixPool *allPools = NULL;
+static pthread_mutex_t poolsLock = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread MatrixPool *myPool = NULL;
+
+static MatrixPool *my_pool()
+{
+  if (myPool == NULL)
+  {
+    MatrixPool *p = (MatrixPool *)aligned_alloc(POOL_ALIGN, sizeof(MatrixPool));
+    assert(p != NULL);
+    for (int i = 0; i < POOL_NUM_CLASSES; i++)
+    {
+      p->local[i] = NULL;
+      atomic_init(&p->remote[i], NULL);
+    }
+    p->hits = p->misses = p->oversize = 0;
+    p->localFrees = p->remoteFrees = 0;
+
+    pthread_mutex_lock(&poolsLock);
+    p->nextPool = allPools;
+    allPools = p;
+    pthread_mutex_unlock(&poolsLock);
+    myPool = p;
+  }
+  return myPool;
+}
+
+// Smallest class whose blocks hold bytes (prefix included), -1 if none
+static int size_class(size_t bytes)
+{
+  bytes += POOL_PREFIX;
+  int cls = 0;
+  while (((size_t)1 << (cls + POOL_MIN_SHIFT)) < bytes)
+  {
+    cls++;
+    if (cls >= POOL_NUM_CLASSES)
+      return -1;
+  }
+  return cls;
+}
+
+void *PoolAlloc(size_t bytes)
+{
+  MatrixPool *p = my_pool();
+  int cls = size_class(bytes);
+  PoolBlock *b;
+
+  if (cls < 0)
+  {
+    size_t total = (POOL_PREFIX + bytes + POOL_ALIGN - 1) / POOL_ALIGN * POOL_ALIGN;
+    b = (PoolBlock *)aligned_alloc(POOL_ALIGN, total);
+    assert(b != NULL);
+    b->owner = p;
+    b->sizeclass = -1;
+    p->oversize++;
+    return (char *)b + POOL_PREFIX;
+  }
+
+  b = p->local[cls];
+  if (b == NULL)
+  {
+    // take back everything other threads have returned since last time
+    b = atomic_exchange_explicit(&p->remote[cls], NULL, memory_order_acquire);
+  }
+
+  if (b != NULL)
+  {
+    p->local[cls] = b->next;
+    p->hits++;
+  }
+  else
+  {
+    b = (PoolBlock *)aligned_alloc(POOL_ALIGN, (size_t)1 << (cls + POOL_MIN_SHIFT));
+    assert(b != NULL);
+    b->owner = p;
+    b->sizeclass = cls;
+    p->misses++;
+  }
+  return (char *)b + POOL_PREFIX;
+}
+
+void PoolFree(void *ptr)
+{
+  if (ptr == NULL)
+    return;
+  PoolBlock *b = (PoolBlock *)((char *)ptr - POOL_PREFIX);
+  if (b->sizeclass < 0)
+  {
+    free(b);
+    return;
+  }
+
+  MatrixPool *p = my_pool();
+  MatrixPool *owner = b->owner;
+  int cls = b->sizeclass;
+  if (owner == p)
+  {
+    b->next = p->local[cls];
+    p->local[cls] = b;
+    p->localFrees++;
+  }
+  else
+  {
+    // lock-free push onto the owner's remote stack
+    PoolBlock *head = atomic_load_explicit(&owner->remote[cls], memory_order_relaxed);
+    do
+    {
+      b->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(&owner->remote[cls], &head, b,
+                                                    memory_order_release, memory_order_relaxed));
+    p->remoteFrees++;
+  }
+}
+
+// Sum stats over all pools.  Only meaningful once the worker threads are joined.
+void GetPoolStats(PoolStats *stats)
+{
+  stats->hits = stats->misses = stats->oversize = 0;
+  stats->localFrees = stats->remoteFrees = 0;
+  stats->pools = 0;
+  pthread_mutex_lock(&poolsLock);
+  for (MatrixPool *p = allPools; p != NULL; p = p->nextPool)
+  {
+    stats->hits += p->hits;
+    stats->misses += p->misses;
+    stats->oversize += p->oversize;
+    stats->localFrees += p->localFrees;
+    stats->remoteFrees += p->remoteFrees;
+    stats->pools++;
+  }
+  pthread_mutex_unlock(&poolsLock);
+}
+
+static void free_list(PoolBlock *b)
+{
+  while (b != NULL)
+  {
+    PoolBlock *next = b->next;
+    free(b);
+    b = next;
+  }
+}
+
+// Release every cached block and every pool.  Call after all threads that
+// used the pool have been joined.
+void PoolShutdown()
+{
+  pthread_mutex_lock(&poolsLock);
+  MatrixPool *p = allPools;
+  allPools = NULL;
+  pthread_mutex_unlock(&poolsLock);
+
+  while (p != NULL)
+  {
+    MatrixPool *next = p->nextPool;
+    for (int i = 0; i < POOL_NUM_CLASSES; i++)
+    {
+      free_list(p->local[i]);
+      free_list(atomic_load(&p->remote[i]));
+    }
+    free(p);
+    p = next;
+  }
+  myPool = NULL;
+}
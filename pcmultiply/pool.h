@@ -0,0 +1,61 @@
+/*
+ *  pool header
+ *  Function prototypes, data, and constants for the matrix pool module
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+// Size classes are powers of two from 128 bytes up to 64 MiB.  The 64-byte
+// pool prefix and the 64-byte matrix header fill the 128-byte class on
+// their own, which suits the element-less views of --input.  A matrix of up
+// to 16 int32s (one more cache line) takes the 256-byte class.  Larger
+// requests bypass the pool and go straight to malloc.
+#define POOL_MIN_SHIFT 7
+#define POOL_NUM_CLASSES 20
+#define POOL_ALIGN 64
+
+// Hidden prefix in front of every pooled block
+typedef struct poolblock
+{
+  struct poolblock *next;
+  struct matrixpool *owner; // pool the block is returned to
+  int sizeclass;            // -1 for oversize blocks that are not pooled
+} PoolBlock;
+
+// One pool per thread.  local[] is only touched by the owning thread.
+// Other threads hand blocks back through remote[], a lock-free stack the
+// owner empties in one atomic exchange when its local list runs dry.
+typedef struct matrixpool
+{
+  PoolBlock *local[POOL_NUM_CLASSES];
+  _Alignas(POOL_ALIGN) _Atomic(PoolBlock *) remote[POOL_NUM_CLASSES];
+  _Alignas(POOL_ALIGN) struct matrixpool *nextPool; // registry of all pools
+
+  // stats, only written by the owning thread
+  long hits;        // allocations served from a free list
+  long misses;      // allocations that had to malloc
+  long oversize;    // allocations too big for any size class
+  long localFrees;  // blocks returned to this thread's own pool
+  long remoteFrees; // blocks this thread returned to another thread's pool
+} MatrixPool;
+
+// Totals over every pool
+typedef struct poolstats
+{
+  long hits;
+  long misses;
+  long oversize;
+  long localFrees;
+  long remoteFrees;
+  int pools;
+} PoolStats;
+
+// POOL ROUTINES
+void *PoolAlloc(size_t bytes);
+void PoolFree(void *ptr);
+void GetPoolStats(PoolStats *stats);
+void PoolShutdown();
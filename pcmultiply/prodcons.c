@@ -15,266 +15,1029 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
-#include <assert.h>
+#include <stdatomic.h>
 #include "counter.h"
 #include "matrix.h"
 #include "pcmatrix.h"
+#include "hist.h"
+#include "waitq.h"
+#include "steal.h"
+#include "pipeline.h"
+#include "matfile.h"
+#include "sink.h"
 #include "prodcons.h"
+#include "ringbuf.h"
+#include "shardbuf.h"
+#include "route.h"
+#include "match.h"
+#include "logger.h"
+#include "rng.h"
 
 Matrix **buffer;
 int headIndex = 0;
 int tailIndex = 0;
 counter_t *currBufferSize;
+
+// lock-free engine (BUFFER_LOCKFREE)
+RingBuf ring;
+
+// sharded engine (BUFFER_SHARDED)
+ShardBuf shards;
+
+// per-rows queues (BUFFER_ROUTED)
+RouteBuf routes;
+
+// Bounded buffer mutex (BUFFER_MUTEX)
+pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Where threads wait for room (not_full) or for matrices (not_empty):
+// a condition variable on the mutex (WAIT_COND) or a futex wait queue
+// (WAIT_FUTEX, waitq.c)
+typedef struct bufferwait
+{
+  pthread_cond_t cond;
+  WaitQ q;
+} BufferWait;
+BufferWait not_full = {.cond = PTHREAD_COND_INITIALIZER};
+BufferWait not_empty = {.cond = PTHREAD_COND_INITIALIZER};
+
+// Set up the bounded buffer for BUFFER_MODE.  Returns NULL if it could not
+// be allocated.
 Matrix **initBoundedBuffer()
 {
   buffer = (Matrix **)malloc(sizeof(Matrix *) * MAX_BOUNDED_BUFFER_SIZE);
 
-  currBufferSize = (counter_t *)malloc(sizeof(counter_t));
-  init_cnt(currBufferSize); // initialize counter to 0
+  // read on every buffer operation, so never sharded (sharded reads sum every shard)
+  currBufferSize = (counter_t *)aligned_alloc(COUNTER_CACHE_LINE, sizeof(counter_t));
+  int rc = buffer == NULL || currBufferSize == NULL ? -1 : 0;
+  if (rc == 0)
+    init_cnt_mode(currBufferSize, COUNTER_MODE == COUNTER_SHARDED ? COUNTER_ATOMIC : COUNTER_MODE); // initialize counter to 0
+
+  if (rc == 0 && BUFFER_MODE == BUFFER_LOCKFREE)
+    rc = ring_init(&ring, MAX_BOUNDED_BUFFER_SIZE);
+  else if (rc == 0 && BUFFER_MODE == BUFFER_SHARDED)
+    rc = shard_init(&shards, NUM_SHARDS, MAX_BOUNDED_BUFFER_SIZE);
+  else if (rc == 0 && BUFFER_MODE == BUFFER_ROUTED)
+    rc = route_init(&routes, MAX_BOUNDED_BUFFER_SIZE);
+  if (rc != 0)
+  {
+    free(buffer);
+    free(currBufferSize);
+    buffer = NULL;
+    currBufferSize = NULL;
+    return NULL;
+  }
+  waitq_init(&not_full.q);
+  waitq_init(&not_empty.q);
   return buffer;
 }
 
+// Release what initBoundedBuffer() set up for the engine in use.  Every
+// worker must have returned.
+void destroyBoundedBuffer()
+{
+  if (BUFFER_MODE == BUFFER_LOCKFREE)
+    ring_destroy(&ring);
+  else if (BUFFER_MODE == BUFFER_SHARDED)
+    shard_destroy(&shards);
+  else if (BUFFER_MODE == BUFFER_ROUTED)
+    route_destroy(&routes);
+  destroy_cnt(currBufferSize);
+  free(currBufferSize);
+  free(buffer);
+  buffer = NULL;
+}
+
 // Bounded buffer put() get()
-int put(Matrix *value)
+//
+// Both routines do their own synchronization so that callers only ever
+// serialize on the enqueue/dequeue itself.  put() blocks while the buffer
+// is full.  get() blocks while it is empty and returns NULL once production
+// has finished and the buffer has drained.
+
+// flag to indicate when production is complete
+int finishedProducing = 0;
+
+// stats of the worker running on this thread, where BENCH_MODE timings go
+static __thread ProdConsStats *threadStats;
+
+// shard this thread tries first (BUFFER_SHARDED), its worker index
+static __thread int homeShard;
+
+void init_stats(ProdConsStats *s)
 {
-  // Don't allow NULL matrices to be put into buffer
-  if (value == NULL)
-  {
-    printf("Error: Attempting to put NULL matrix\n");
-    return -1;
-  }
+  s->sumtotal = 0;
+  s->multtotal = 0;
+  s->matrixtotal = 0;
+  s->fullWait = 0;
+  s->emptyWait = 0;
+  s->lockHold = 0;
+  s->genTime = 0;
+  s->multTime = 0;
+  s->lockAcquires = 0;
+  s->condWaits = 0;
+  s->spuriousWakeups = 0;
+  s->discarded = 0;
+  s->stolen = 0;
+  s->stolenLive = 0;
+  s->corrupt = 0;
+  s->wait = (WaitStats){0};
+  hist_init(&s->putWait);
+  hist_init(&s->getWait);
+  hist_init(&s->residency);
+}
 
-  // Only put if there's space
-  if (get_cnt(currBufferSize) >= MAX_BOUNDED_BUFFER_SIZE)
-  {
-    printf("Error: Buffer full, cannot put matrix\n");
-    return -1;
-  }
+// Fold one thread's stats into the totals
+void add_stats(ProdConsStats *total, const ProdConsStats *s)
+{
+  total->matrixtotal += s->matrixtotal;
+  total->sumtotal += s->sumtotal;
+  total->multtotal += s->multtotal;
+  total->fullWait += s->fullWait;
+  total->emptyWait += s->emptyWait;
+  total->lockHold += s->lockHold;
+  total->genTime += s->genTime;
+  total->multTime += s->multTime;
+  total->lockAcquires += s->lockAcquires;
+  total->condWaits += s->condWaits;
+  total->spuriousWakeups += s->spuriousWakeups;
+  total->discarded += s->discarded;
+  total->stolen += s->stolen;
+  total->stolenLive += s->stolenLive;
+  total->corrupt += s->corrupt;
+  total->wait.spinWins += s->wait.spinWins;
+  total->wait.parks += s->wait.parks;
+  total->wait.wakes += s->wait.wakes;
+  total->wait.skipped += s->wait.skipped;
+  hist_merge(&total->putWait, &s->putWait);
+  hist_merge(&total->getWait, &s->getWait);
+  hist_merge(&total->residency, &s->residency);
+}
 
-  printf("PUT Matrix:\n");
-  buffer[headIndex] = value;
-  DisplayMatrix(buffer[headIndex], stdout);
+// STATS_MODE timing is only taken on worker threads
+#define TIMING() (STATS_MODE && threadStats != NULL)
 
-  headIndex = (headIndex + 1) % MAX_BOUNDED_BUFFER_SIZE;
+// when this thread last took the bounded buffer mutex (STATS_MODE)
+static __thread uint64_t lockedAt;
 
-  increment_cnt(currBufferSize);
-  return 0;
+static void buffer_lock()
+{
+  pthread_mutex_lock(&mutex);
+  if (threadStats != NULL)
+    threadStats->lockAcquires++;
+  if (TIMING())
+    lockedAt = now_ns();
 }
 
-Matrix *get()
+static void buffer_unlock()
 {
-  assert(get_cnt(currBufferSize) > 0); // there must be at least 1 matrix to retrieve
+  if (TIMING())
+    threadStats->lockHold += now_ns() - lockedAt;
+  pthread_mutex_unlock(&mutex);
+}
 
-  if (buffer[tailIndex] == NULL)
+// Wait on w, releasing the bounded buffer mutex meanwhile.  Called with
+// the mutex held after finding the buffer full/empty, returns with it held.
+// With WAIT_FUTEX the ticket is taken under the mutex, so any put/get after
+// we let go moves the word on and the wait cannot miss it.
+static void wait_unlocked(BufferWait *w)
+{
+  if (WAIT_MODE == WAIT_COND)
   {
-    printf("Error: Attempting to get NULL matrix\n");
-    return NULL;
+    pthread_cond_wait(&w->cond, &mutex);
+    return;
   }
+  unsigned int ticket = waitq_prepare(&w->q);
+  pthread_mutex_unlock(&mutex);
+  waitq_wait(&w->q, ticket);
+  pthread_mutex_lock(&mutex);
+}
 
-  printf("GET Matrix:\n");
-
-  Matrix *value = buffer[tailIndex];
-  DisplayMatrix(value, stdout);
-
-  tailIndex = (tailIndex + 1) % MAX_BOUNDED_BUFFER_SIZE;
+// Wait on w, adding the time blocked to *waited.  The wait does not count
+// as lock hold time.
+static void buffer_wait(BufferWait *w, uint64_t *waited)
+{
+  if (threadStats != NULL)
+    threadStats->condWaits++;
+  if (!TIMING())
+  {
+    wait_unlocked(w);
+    return;
+  }
+  uint64_t start = now_ns();
+  threadStats->lockHold += start - lockedAt;
+  wait_unlocked(w);
+  lockedAt = now_ns();
+  *waited += lockedAt - start;
+}
 
-  decrement_cnt(currBufferSize);
-  return value;
+// Wake one thread waiting on w.  put/get call this after releasing the
+// mutex, so the woken thread does not go straight back to sleep on it.
+static void buffer_notify(BufferWait *w)
+{
+  if (WAIT_MODE == WAIT_COND)
+    pthread_cond_signal(&w->cond);
+  else
+    waitq_notify(&w->q, 1);
 }
 
-// Bounded buffer mutex and condition variables
-pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_cond_t not_full = PTHREAD_COND_INITIALIZER;
-pthread_cond_t not_empty = PTHREAD_COND_INITIALIZER;
+int put(Matrix *value)
+{
+  return put_batch(&value, 1) == 1 ? 0 : -1;
+}
 
-// flag to indicate when production is complete
-int finishedProducing = 0;
+Matrix *get()
+{
+  Matrix *value;
+  return get_batch(&value, 1) == 1 ? value : NULL;
+}
 
-// Matrix PRODUCER worker thread
-void *prod_worker(void *arg)
+// Queue n matrices, taking the lock once per stretch that fits and waking
+// consumers once per stretch instead of once per matrix.  Returns n, or -1
+// if any of the matrices is NULL.
+int put_batch(Matrix **values, int n)
 {
-  // get counter from args
-  counter_t *prodCounter = (counter_t *)arg;
+  for (int i = 0; i < n; i++)
+  {
+    // Don't allow NULL matrices to be put into buffer
+    if (values[i] == NULL)
+    {
+      printf("Error: Attempting to put NULL matrix\n");
+      return -1;
+    }
+  }
 
-  // Individual stats for this thread
-  ProdConsStats *prodStats = (ProdConsStats *)(malloc(sizeof(ProdConsStats)));
+  // print before queueing, a consumer may free the matrix right after
+  if (LOG_ENABLED(LOG_ALL))
+  {
+    FILE *out = LogBegin();
+    for (int i = 0; i < n; i++)
+    {
+      fprintf(out, "PUT Matrix:\n");
+      DisplayMatrix(values[i], out);
+    }
+    LogEnd(out);
+  }
 
-  // init stats
-  prodStats->sumtotal = 0;
-  prodStats->multtotal = 0;
-  prodStats->matrixtotal = 0;
+  // residency is measured from here, so it includes any wait for room
+  uint64_t start = 0;
+  if (BENCH_MODE)
+  {
+    start = now_ns();
+    for (int i = 0; i < n; i++)
+      values[i]->enqueued = start;
+  }
 
-  while (get_cnt(prodCounter) < NUMBER_OF_MATRICES)
+  if (BUFFER_MODE == BUFFER_LOCKFREE)
   {
-    // critical section
-    pthread_mutex_lock(&mutex);
+    int done = ring_put_batch(&ring, (void **)values, n);
+    if (BENCH_MODE && threadStats != NULL)
+      hist_record(&threadStats->putWait, now_ns() - start);
+    return done;
+  }
+  if (BUFFER_MODE == BUFFER_SHARDED || BUFFER_MODE == BUFFER_ROUTED)
+  {
+    int done = BUFFER_MODE == BUFFER_SHARDED ? shard_put_batch(&shards, homeShard, (void **)values, n)
+                                             : route_put_batch(&routes, values, n);
+    if (BENCH_MODE && threadStats != NULL)
+      hist_record(&threadStats->putWait, now_ns() - start);
+    return done;
+  }
 
+  int done = 0;
+  buffer_lock();
+  while (done < n)
+  {
     // keep waiting when buffer is full
-    while (get_cnt(currBufferSize) >= MAX_BOUNDED_BUFFER_SIZE)
+    for (int woken = 0; get_cnt(currBufferSize) >= MAX_BOUNDED_BUFFER_SIZE; woken = 1)
     {
-      pthread_cond_wait(&not_full, &mutex);
+      // woken and still full: spurious, or another producer got there first
+      if (woken && threadStats != NULL)
+        threadStats->spuriousWakeups++;
+      buffer_wait(&not_full, threadStats ? &threadStats->fullWait : NULL);
     }
 
-    // when thread is woken, check again since another prod worker may have added a matrix
-    if (get_cnt(prodCounter) >= NUMBER_OF_MATRICES)
+    while (done < n && get_cnt(currBufferSize) < MAX_BOUNDED_BUFFER_SIZE)
     {
-      // finish early
-      pthread_cond_signal(&not_empty);
-      pthread_mutex_unlock(&mutex);
-      return (void *)prodStats;
+      buffer[headIndex] = values[done++];
+      headIndex = (headIndex + 1) % MAX_BOUNDED_BUFFER_SIZE;
+      increment_cnt(currBufferSize);
     }
 
-    Matrix *matrix;
-    if (MATRIX_MODE == 0)
+    // about to wait for room: let a consumer at this stretch first
+    if (done < n)
+      buffer_notify(&not_empty);
+  }
+
+  // pass the baton if there is still room for another waiting producer
+  int roomLeft = get_cnt(currBufferSize) < MAX_BOUNDED_BUFFER_SIZE;
+  buffer_unlock();
+
+  // signal consumers, one wakeup for the whole stretch
+  buffer_notify(&not_empty);
+  if (roomLeft)
+    buffer_notify(&not_full);
+
+  if (BENCH_MODE && threadStats != NULL)
+    hist_record(&threadStats->putWait, now_ns() - start);
+  return done;
+}
+
+// Record and log the count matrices a get just took, start is when it began
+static void got_matrices(Matrix **values, int count, uint64_t start)
+{
+  // the final empty get() is end of stream, not a wait worth recording
+  if (BENCH_MODE && threadStats != NULL && count > 0)
+  {
+    uint64_t now = now_ns();
+    hist_record(&threadStats->getWait, now - start);
+    for (int i = 0; i < count; i++)
+      hist_record(&threadStats->residency, now - values[i]->enqueued);
+  }
+
+  if (LOG_ENABLED(LOG_ALL))
+  {
+    FILE *out = LogBegin();
+    for (int i = 0; i < count; i++)
     {
-      // no size given, generate random
-      matrix = GenMatrixRandom();
+      fprintf(out, "GET Matrix:\n");
+      DisplayMatrix(values[i], out);
     }
-    else
+    LogEnd(out);
+  }
+}
+
+// Take up to max matrices off the mutex engine's ring and release the
+// mutex.  Called with the mutex held and the buffer not empty.
+static int take_unlock(Matrix **values, int max)
+{
+  int count = 0;
+  while (count < max && get_cnt(currBufferSize) > 0)
+  {
+    values[count++] = buffer[tailIndex];
+    tailIndex = (tailIndex + 1) % MAX_BOUNDED_BUFFER_SIZE;
+    decrement_cnt(currBufferSize);
+  }
+
+  // signal producers, slots just opened up, and pass the baton if
+  // matrices are left for another waiting consumer
+  int left = get_cnt(currBufferSize) > 0;
+  buffer_unlock();
+  buffer_notify(&not_full);
+  if (left)
+    buffer_notify(&not_empty);
+  return count;
+}
+
+// Dequeue up to max matrices.  Blocks until at least one is available, then
+// takes whatever else is queued, under one lock and with one producer
+// wakeup.  Returns the number taken, 0 once production has finished and the
+// buffer has drained.
+int get_batch(Matrix **values, int max)
+{
+  int count = 0;
+  uint64_t start = BENCH_MODE ? now_ns() : 0;
+
+  if (BUFFER_MODE == BUFFER_LOCKFREE)
+  {
+    count = ring_get_batch(&ring, (void **)values, max);
+  }
+  else if (BUFFER_MODE == BUFFER_SHARDED)
+  {
+    // home shard first, then steal from the others
+    count = shard_get_batch(&shards, homeShard, (void **)values, max);
+  }
+  else if (BUFFER_MODE == BUFFER_ROUTED)
+  {
+    count = route_get_batch(&routes, values, max);
+  }
+  else
+  {
+    buffer_lock();
+
+    // keep waiting when buffer is empty
+    for (int woken = 0; get_cnt(currBufferSize) <= 0; woken = 1)
     {
-      // size given
-      matrix = GenMatrixBySize(MATRIX_MODE, MATRIX_MODE);
+      if (finishedProducing)
+      {
+        buffer_unlock();
+        return 0;
+      }
+      // woken and still empty: spurious, or another consumer got there first
+      if (woken && threadStats != NULL)
+        threadStats->spuriousWakeups++;
+      buffer_wait(&not_empty, threadStats ? &threadStats->emptyWait : NULL);
     }
 
-    put(matrix);
+    count = take_unlock(values, max);
+  }
 
-    // Update this thread's statistics
-    prodStats->matrixtotal++;
-    prodStats->sumtotal += SumMatrix(matrix);
+  got_matrices(values, count, start);
+  return count;
+}
 
-    // Update synchronized counter
-    increment_cnt(prodCounter);
+// Non-blocking get_batch(): takes up to max matrices if any are queued and
+// returns 0 straight away if the buffer is empty, whether or not production
+// has finished.  Only get_batch() reports end of stream.
+int try_get_batch(Matrix **values, int max)
+{
+  int count = 0;
+  uint64_t start = BENCH_MODE ? now_ns() : 0;
+
+  if (BUFFER_MODE == BUFFER_LOCKFREE)
+    count = ring_try_get_batch(&ring, (void **)values, max);
+  else if (BUFFER_MODE == BUFFER_SHARDED)
+    count = shard_try_get_batch(&shards, homeShard, (void **)values, max);
+  else if (BUFFER_MODE == BUFFER_ROUTED)
+    count = route_try_get_batch(&routes, values, max);
+  else
+  {
+    buffer_lock();
+    if (get_cnt(currBufferSize) <= 0)
+    {
+      buffer_unlock();
+      return 0;
+    }
+    count = take_unlock(values, max);
+  }
 
-    // signal consumers
-    pthread_cond_signal(&not_empty);
+  if (count > 0)
+    got_matrices(values, count, start);
+  return count;
+}
 
-    pthread_mutex_unlock(&mutex);
+// Dequeue a partner with the given row count (BUFFER_ROUTED).  May return
+// a matrix that does not fit when the buffer is full or closed and none
+// with those rows is queued.  NULL once production has finished and the
+// buffer has drained.
+Matrix *get_rows(int rows)
+{
+  uint64_t start = BENCH_MODE ? now_ns() : 0;
+  Matrix *value = route_get_rows(&routes, rows);
+  got_matrices(&value, value != NULL, start);
+  return value;
+}
+
+// Mark the end of production, get() returns NULL once the buffer drains
+void closeBoundedBuffer()
+{
+  if (BUFFER_MODE == BUFFER_LOCKFREE)
+  {
+    ring_close(&ring);
+    return;
+  }
+  if (BUFFER_MODE == BUFFER_SHARDED)
+  {
+    finishedProducing = 1;
+    shard_close(&shards);
+    return;
+  }
+  if (BUFFER_MODE == BUFFER_ROUTED)
+  {
+    finishedProducing = 1;
+    route_close(&routes);
+    return;
   }
 
   // lock to avoid race condition
   pthread_mutex_lock(&mutex);
   finishedProducing = 1;
-  pthread_cond_broadcast(&not_empty); // Wake up all consumers to avoid deadlock
+  pthread_cond_broadcast(&not_empty.cond); // Wake up all consumers to avoid deadlock
   pthread_mutex_unlock(&mutex);
+  waitq_notify_all(&not_empty.q);
+}
 
-  return (void *)prodStats;
+// Producers split NUMBER_OF_MATRICES statically by thread index so every
+// producer makes a fixed number of matrices from its own random stream and
+// a seeded run is repeatable.
+//
+// Shutdown is an epoch close: the last producer to leave closes the
+// buffer, however many matrices were actually made.  Consumers drain
+// whatever is queued, the close wakes each parked consumer exactly once,
+// and every get after that returns end of stream, so no matrix is left
+// behind and no consumer rechecks counters.  stopProduction() makes
+// producers leave early, after the batch they are on, and the same close
+// then ends the run with produced == consumed.
+atomic_int exitedProducers = 0;
+atomic_int stopRequested = 0;
+
+// Ask producers to stop after their current batch.  Only does an atomic
+// store, so it is safe to call from a signal handler.
+void stopProduction()
+{
+  atomic_store(&stopRequested, 1);
 }
 
-// Matrix CONSUMER worker thread
-void *cons_worker(void *arg)
+// Whether production ended before every producer made its share
+int productionStopped()
 {
-  // get counter from args
-  counter_t *consCounter = (counter_t *)arg;
+  return atomic_load(&stopRequested);
+}
+
+// Matrix PRODUCER worker thread
+void *prod_worker(void *arg)
+{
+  // get counter and thread index from args
+  WorkerArgs *args = (WorkerArgs *)arg;
+  counter_t *prodCounter = args->counter;
+
+  // this producer's share of the matrices and its own random stream
+  int quota = NUMBER_OF_MATRICES / args->nworkers + (args->id < NUMBER_OF_MATRICES % args->nworkers);
+  // first of them, when replaying an input file
+  int first = NUMBER_OF_MATRICES / args->nworkers * args->id +
+              (args->id < NUMBER_OF_MATRICES % args->nworkers ? args->id : NUMBER_OF_MATRICES % args->nworkers);
+  rng_thread_seed(RNG_SEED, (uint64_t)args->id);
 
   // Individual stats for this thread
-  ProdConsStats *consStats = (ProdConsStats *)(malloc(sizeof(ProdConsStats)));
+  ProdConsStats *prodStats = (ProdConsStats *)(malloc(sizeof(ProdConsStats)));
 
   // init stats
-  consStats->sumtotal = 0;
-  consStats->multtotal = 0;
-  consStats->matrixtotal = 0;
+  init_stats(prodStats);
+  threadStats = prodStats;
+  homeShard = args->id;
 
-  Matrix *m1, *m2, *m3;
+  Matrix **batch = (Matrix **)malloc(sizeof(Matrix *) * BATCH_SIZE);
 
-  while (get_cnt(consCounter) < NUMBER_OF_MATRICES)
+  // produce BATCH_SIZE matrices at a time, the last batch may come up short
+  for (int done = 0; done < quota && !atomic_load_explicit(&stopRequested, memory_order_relaxed);)
   {
-    // critical section
-    pthread_mutex_lock(&mutex);
+    int n = quota - done < BATCH_SIZE ? quota - done : BATCH_SIZE;
+    int64_t sum = 0;
+    uint64_t start = STATS_MODE ? now_ns() : 0;
 
-    // keep waiting when buffer is empty
-    while (get_cnt(currBufferSize) <= 0)
+    // generation runs outside any lock, producers work fully in parallel
+    for (int i = 0; i < n; i++)
     {
-      if (finishedProducing && get_cnt(currBufferSize) == 0)
+      if (matrixInput != NULL)
       {
-        pthread_mutex_unlock(&mutex);
-        return (void *)consStats;
+        // zero-copy view into the mapped file, cycling if it runs out
+        batch[i] = matfile_view(matrixInput, (first + done + i) % matrixInput->count);
       }
-
-      pthread_cond_wait(&not_empty, &mutex);
-
-      // when thread is woken, check again since another cons worker may have consumed a matrix
-      if (get_cnt(consCounter) >= NUMBER_OF_MATRICES)
+      else if (MATRIX_MODE == 0)
       {
-        // finish early
-        pthread_mutex_unlock(&mutex);
-        return (void *)consStats;
+        // no size given, generate random
+        batch[i] = GenMatrixRandom();
       }
+      else
+      {
+        // size given
+        batch[i] = GenMatrixBySize(MATRIX_MODE, MATRIX_MODE);
+      }
+
+      // read before put, a consumer may free the matrix as soon as it is queued
+      sum += batch[i]->sum;
     }
+    if (STATS_MODE)
+      prodStats->genTime += now_ns() - start;
 
-    m1 = get();
+    put_batch(batch, n);
+    done += n;
 
     // Update this thread's statistics
-    consStats->matrixtotal++; // Count consumption
-    consStats->sumtotal += SumMatrix(m1);
+    prodStats->matrixtotal += n;
+    prodStats->sumtotal += sum;
 
     // Update synchronized counter
-    increment_cnt(consCounter);
+    for (int i = 0; i < n; i++)
+      increment_cnt(prodCounter);
+  }
+
+  // every put of every producer has returned once the last one gets here
+  if (atomic_fetch_add(&exitedProducers, 1) + 1 == args->nworkers)
+    closeBoundedBuffer();
+
+  free(batch);
+  waitq_thread_stats(&prodStats->wait);
+  return (void *)prodStats;
+}
+
+// Matrices a consumer has taken off the bounded buffer but not used yet
+typedef struct consumerbatch
+{
+  Matrix **items;
+  int count;
+  int next;
+} ConsumerBatch;
+
+// Next matrix for this consumer, refilled BATCH_SIZE at a time from the
+// bounded buffer.  NULL at end of stream.
+static Matrix *next_matrix(ConsumerBatch *cb)
+{
+  if (cb->next == cb->count)
+  {
+    cb->count = get_batch(cb->items, BATCH_SIZE);
+    cb->next = 0;
+    if (cb->count == 0)
+      return NULL;
+  }
+  return cb->items[cb->next++];
+}
+
+// Count a dequeued matrix in this consumer's stats and the shared counter
+static void count_consumed(Matrix *m, counter_t *consCounter, ProdConsStats *consStats)
+{
+  // Update this thread's statistics
+  consStats->matrixtotal++; // Count consumption
+  if (VERIFY_MODE == VERIFY_SUM)
+  {
+    int64_t sum = SumMatrix(m);
+    if (sum != m->sum)
+      consStats->corrupt++;
+    consStats->sumtotal += sum;
+  }
+  else
+  {
+    if (VERIFY_MODE == VERIFY_CRC && MatrixCrc(m) != m->crc)
+      consStats->corrupt++;
+    consStats->sumtotal += m->sum;
+  }
+
+  // Update synchronized counter
+  increment_cnt(consCounter);
+}
+
+// MatrixMultiply(), timed into consStats with STATS_MODE
+static Matrix *timed_multiply(Matrix *m1, Matrix *m2, ProdConsStats *consStats)
+{
+  if (!STATS_MODE)
+    return MatrixMultiply(m1, m2);
+  uint64_t start = now_ns();
+  Matrix *m3 = MatrixMultiply(m1, m2);
+  consStats->multTime += now_ns() - start;
+  return m3;
+}
+
+// Print m1 x m2 = m3 and free all three
+static void finish_product(Matrix *m1, Matrix *m2, Matrix *m3)
+{
+  // show results, as one block so other consumers don't interleave
+  if (LOG_ENABLED(LOG_PRODUCTS))
+  {
+    FILE *out = LogBegin();
+    DisplayMatrix(m1, out);
+    fprintf(out, "   X\n");
+    DisplayMatrix(m2, out);
+    fprintf(out, "   =\n");
+    DisplayMatrix(m3, out);
+    LogEnd(out);
+  }
+
+  // persist the result, the writer thread does the I/O (sink.c)
+  SinkWrite(m1, m2, m3);
+
+  // clean up
+  FreeMatrix(m1);
+  FreeMatrix(m2);
+  FreeMatrix(m3);
+}
+
+// Original consumer: hold m1 and discard matrices until one fits as m2
+static void consume_pairwise(ConsumerBatch *cb, counter_t *consCounter, ProdConsStats *consStats)
+{
+  Matrix *m1, *m2, *m3;
+
+  // blocks until a matrix arrives, NULL at end of stream
+  while ((m1 = next_matrix(cb)) != NULL)
+  {
+    count_consumed(m1, consCounter, consStats);
 
     /* Originally, we were grabbing
     two matrices on every step of the while loop in prod_worker().
     Claude.ai gave us code to grab one matrix at a time. */
 
-    int matrixIsValid = 0;
-    while (!matrixIsValid)
+    m3 = NULL;
+    while (m3 == NULL)
     {
-      // keep waiting when buffer is empty
-      while (get_cnt(currBufferSize) <= 0)
+      // routed buffer: ask for a matrix with exactly the rows m1 needs
+      m2 = BUFFER_MODE == BUFFER_ROUTED ? get_rows(m1->cols) : next_matrix(cb);
+      if (m2 == NULL)
+      {
+        // stream ended before m1 found a partner
+        FreeMatrix(m1);
+        consStats->discarded++;
+        break;
+      }
+      count_consumed(m2, consCounter, consStats);
+
+      m3 = timed_multiply(m1, m2, consStats);
+      if (m3 == NULL)
       {
-        if (finishedProducing && get_cnt(currBufferSize) == 0)
-        {
-          FreeMatrix(m1);
-          pthread_mutex_unlock(&mutex);
-          return (void *)consStats;
-        }
-
-        pthread_cond_wait(&not_empty, &mutex);
-
-        // when thread is woken, check again since another cons worker may have consumed a matrix
-        if (get_cnt(consCounter) >= NUMBER_OF_MATRICES)
-        {
-          pthread_mutex_unlock(&mutex);
-          return (void *)consStats;
-        }
+        FreeMatrix(m2); // Invalid M2, try another
+        consStats->discarded++;
       }
+    }
+    // no partner: next_matrix() still hands out whatever is left of this
+    // consumer's batch (routed), otherwise it reports end of stream
+    if (m3 == NULL)
+      continue;
+    consStats->multtotal++; // Count successful multiplication
 
-      m2 = get();
+    finish_product(m1, m2, m3);
+  }
+}
 
-      // Update this thread's statistics
-      consStats->matrixtotal++;
-      consStats->sumtotal += SumMatrix(m2);
+// Matching consumer (MATCH_MODE): every dequeued matrix is paired with a
+// compatible pending one if there is one, and parked in the index otherwise
+static void consume_matching(ConsumerBatch *cb, counter_t *consCounter, ProdConsStats *consStats)
+{
+  MatchIndex *mi = (MatchIndex *)malloc(sizeof(MatchIndex));
+  match_init(mi);
 
-      // Update synchronized counter
-      increment_cnt(consCounter);
+  Matrix *x;
+  while ((x = next_matrix(cb)) != NULL)
+  {
+    count_consumed(x, consCounter, consStats);
 
-      m3 = MatrixMultiply(m1, m2);
-      if (m3 != NULL)
-      {
-        consStats->multtotal++; // Count successful multiplication
-        matrixIsValid = 1;
-      }
-      else
+    int partnerFirst;
+    Matrix *partner = match_partner(mi, x, &partnerFirst);
+    if (partner == NULL)
+    {
+      // nothing fits yet, wait for a partner (may push out the oldest)
+      Matrix *evicted = match_insert(mi, x);
+      if (evicted != NULL)
       {
-        FreeMatrix(m2); // Invalid M2, try another
+        FreeMatrix(evicted);
+        consStats->discarded++;
       }
+      continue;
+    }
+
+    Matrix *m1 = partnerFirst ? partner : x;
+    Matrix *m2 = partnerFirst ? x : partner;
+    Matrix *m3 = timed_multiply(m1, m2, consStats);
+    consStats->multtotal++; // Count successful multiplication
+
+    finish_product(m1, m2, m3);
+  }
+
+  // stream ended, whatever is still pending never found a partner
+  while ((x = match_pop(mi)) != NULL)
+  {
+    FreeMatrix(x);
+    consStats->discarded++;
+  }
+  free(mi);
+}
+
+// Multiply one pair and count it
+static void multiply_pair(MatrixPair p, ProdConsStats *consStats)
+{
+  Matrix *m3 = timed_multiply(p.m1, p.m2, consStats);
+  consStats->multtotal++; // Count successful multiplication
+  finish_product(p.m1, p.m2, m3);
+}
+
+// Queue a pair on this consumer's deque, or multiply it right away if the
+// deque has no room
+static void queue_pair(int id, Matrix *m1, Matrix *m2, ProdConsStats *consStats)
+{
+  MatrixPair p = {m1, m2};
+  if (steal_push(stealPool, id, p) != 0)
+    multiply_pair(p, consStats);
+}
+
+// Pairs up dequeued matrices without multiplying them (STEAL_MODE and the
+// pipeline's pairing stage).  Pairing follows MATCH_MODE, otherwise m1 is
+// held and matrices that do not fit it are discarded, as in consume_pairwise.
+typedef struct pairer
+{
+  MatchIndex *mi; // pending matrices (MATCH_MODE)
+  Matrix *held;   // m1 waiting for a partner otherwise
+} Pairer;
+
+static void pairer_init(Pairer *pr)
+{
+  pr->mi = NULL;
+  pr->held = NULL;
+  if (MATCH_MODE)
+  {
+    pr->mi = (MatchIndex *)malloc(sizeof(MatchIndex));
+    match_init(pr->mi);
+  }
+}
+
+// Offer x to the pairer.  Returns 1 and fills *p if x completed a pair.
+static int pairer_add(Pairer *pr, Matrix *x, MatrixPair *p, ProdConsStats *consStats)
+{
+  if (MATCH_MODE)
+  {
+    int partnerFirst;
+    Matrix *partner = match_partner(pr->mi, x, &partnerFirst);
+    if (partner != NULL)
+    {
+      p->m1 = partnerFirst ? partner : x;
+      p->m2 = partnerFirst ? x : partner;
+      return 1;
     }
+    Matrix *evicted = match_insert(pr->mi, x);
+    if (evicted != NULL)
+    {
+      FreeMatrix(evicted);
+      consStats->discarded++;
+    }
+  }
+  else if (pr->held == NULL)
+  {
+    pr->held = x;
+  }
+  else if (pr->held->cols == x->rows)
+  {
+    p->m1 = pr->held;
+    p->m2 = x;
+    pr->held = NULL;
+    return 1;
+  }
+  else
+  {
+    FreeMatrix(x); // Invalid M2, try another
+    consStats->discarded++;
+  }
+  return 0;
+}
+
+// Stream ended, whatever is still unpaired never found a partner
+static void pairer_drain(Pairer *pr, ProdConsStats *consStats)
+{
+  if (pr->held != NULL)
+  {
+    FreeMatrix(pr->held);
+    consStats->discarded++;
+  }
+  if (pr->mi != NULL)
+  {
+    Matrix *x;
+    while ((x = match_pop(pr->mi)) != NULL)
+    {
+      FreeMatrix(x);
+      consStats->discarded++;
+    }
+    free(pr->mi);
+  }
+}
+
+// Count and pair n matrices a consumer just took, queueing the pairs on
+// its own deque
+static void pair_matrices(Pairer *pr, Matrix **items, int n, int id, counter_t *consCounter, ProdConsStats *consStats)
+{
+  for (int i = 0; i < n; i++)
+  {
+    MatrixPair p;
+    count_consumed(items[i], consCounter, consStats);
+    if (pairer_add(pr, items[i], &p, consStats))
+      queue_pair(id, p.m1, p.m2, consStats);
+  }
+}
+
+// Work-stealing consumer (STEAL_MODE): pairs go onto this consumer's deque
+// instead of being multiplied on the spot.  Each round the consumer tops up
+// its deque from whatever is already in the buffer, without blocking, while
+// it holds fewer than STEAL_DEPTH pairs.  It then multiplies its own newest
+// pair, or failing that steals the oldest pair from a peer.  It only blocks
+// on the buffer when its own deque is empty and no peer had anything to
+// steal, so an idle consumer steals rather than parks.
+static void consume_stealing(ConsumerBatch *cb, int id, counter_t *consCounter, ProdConsStats *consStats)
+{
+  Pairer pr;
+  pairer_init(&pr);
+  int ended = 0;
+
+  for (;;)
+  {
+    MatrixPair p;
+    if (!ended && steal_size(stealPool, id) < STEAL_DEPTH)
+      pair_matrices(&pr, cb->items, try_get_batch(cb->items, BATCH_SIZE), id, consCounter, consStats);
+
+    if (steal_pop(stealPool, id, &p))
+    {
+      multiply_pair(p, consStats);
+    }
+    else if (steal_take(stealPool, id, &p))
+    {
+      consStats->stolen++;
+      if (!ended)
+        consStats->stolenLive++;
+      multiply_pair(p, consStats);
+    }
+    else if (ended)
+    {
+      break;
+    }
+    else
+    {
+      // nothing of our own and nothing to steal, wait for the buffer
+      int n = get_batch(cb->items, BATCH_SIZE);
+      if (n == 0)
+        ended = 1;
+      pair_matrices(&pr, cb->items, n, id, consCounter, consStats);
+    }
+  }
+
+  pairer_drain(&pr, consStats);
+}
+
+// PIPELINE STAGES (PIPELINE_MODE)
+// Each consumer thread runs one stage.  A stage thread that runs out of
+// input calls stage_leave() on the queue it feeds, so end of stream moves
+// down the pipeline one stage at a time.
+
+// Pairing stage: matrices off the bounded buffer, pairs onto pairQueue
+static void stage_pair(ConsumerBatch *cb, counter_t *consCounter, ProdConsStats *consStats)
+{
+  Pairer pr;
+  pairer_init(&pr);
+
+  // a batch of n matrices completes at most n pairs
+  StageItem *out = (StageItem *)malloc(sizeof(StageItem) * BATCH_SIZE);
+  int n;
+  while ((n = get_batch(cb->items, BATCH_SIZE)) > 0)
+  {
+    int pairs = 0;
+    for (int i = 0; i < n; i++)
+    {
+      MatrixPair p;
+      count_consumed(cb->items[i], consCounter, consStats);
+      if (pairer_add(&pr, cb->items[i], &p, consStats))
+        out[pairs++] = (StageItem){p.m1, p.m2, NULL};
+    }
+    if (pairs > 0)
+      stage_put_batch(pairQueue, out, pairs);
+  }
+
+  pairer_drain(&pr, consStats);
+  free(out);
+}
+
+// Multiply stage: pairs off pairQueue, products onto productQueue
+static void stage_multiply(ProdConsStats *consStats)
+{
+  StageItem *items = (StageItem *)malloc(sizeof(StageItem) * BATCH_SIZE);
+  int n;
+  while ((n = stage_get_batch(pairQueue, items, BATCH_SIZE)) > 0)
+  {
+    for (int i = 0; i < n; i++)
+      items[i].m3 = timed_multiply(items[i].m1, items[i].m2, consStats);
+    stage_put_batch(productQueue, items, n);
+  }
+  free(items);
+}
 
-    // show results
-    DisplayMatrix(m1, stdout);
-    printf("   X\n");
-    DisplayMatrix(m2, stdout);
-    printf("   =\n");
-    DisplayMatrix(m3, stdout);
+// Reduce stage: products off productQueue, counted, shown, written, freed
+static void stage_reduce(ProdConsStats *consStats)
+{
+  StageItem *items = (StageItem *)malloc(sizeof(StageItem) * BATCH_SIZE);
+  int n;
+  while ((n = stage_get_batch(productQueue, items, BATCH_SIZE)) > 0)
+  {
+    for (int i = 0; i < n; i++)
+    {
+      consStats->multtotal++; // Count successful multiplication
+      finish_product(items[i].m1, items[i].m2, items[i].m3);
+    }
+  }
+  free(items);
+}
 
-    // clean up
-    FreeMatrix(m1);
-    FreeMatrix(m2);
-    FreeMatrix(m3);
+// Matrix CONSUMER worker thread
+void *cons_worker(void *arg)
+{
+  // get counter from args
+  WorkerArgs *args = (WorkerArgs *)arg;
+  counter_t *consCounter = args->counter;
 
-    // signal producers
-    pthread_cond_signal(&not_full);
+  // Individual stats for this thread
+  ProdConsStats *consStats = (ProdConsStats *)(malloc(sizeof(ProdConsStats)));
+
+  // init stats
+  init_stats(consStats);
+  threadStats = consStats;
+  homeShard = args->id;
+
+  ConsumerBatch cb;
+  cb.items = (Matrix **)malloc(sizeof(Matrix *) * BATCH_SIZE);
+  cb.count = 0;
+  cb.next = 0;
 
-    pthread_mutex_unlock(&mutex);
+  if (PIPELINE_MODE && args->stage == STAGE_PAIR)
+  {
+    stage_pair(&cb, consCounter, consStats);
+    stage_leave(pairQueue, args->nworkers);
+  }
+  else if (PIPELINE_MODE && args->stage == STAGE_MULTIPLY)
+  {
+    stage_multiply(consStats);
+    stage_leave(productQueue, args->nworkers);
   }
+  else if (PIPELINE_MODE)
+    stage_reduce(consStats);
+  else if (STEAL_MODE)
+    consume_stealing(&cb, args->id, consCounter, consStats);
+  else if (MATCH_MODE)
+    consume_matching(&cb, consCounter, consStats);
+  else
+    consume_pairwise(&cb, consCounter, consStats);
 
+  free(cb.items);
+  SinkFlushThread();
+  waitq_thread_stats(&consStats->wait);
   return (void *)consStats;
-}
\ No newline at end of file
+}
@@ -9,26 +9,78 @@
 Matrix **buffer;
 counters_t *counter;
 
+// per-consumer pair deques (STEAL_MODE)
+StealPool *stealPool;
+
+// queues between the pipeline stages (PIPELINE_MODE): pairs for the
+// multiply stage, products for the reduce stage
+StageQueue *pairQueue;
+StageQueue *productQueue;
+
+// mapped input file producers replay instead of generating, NULL if none
+MatFile *matrixInput;
+
 // PRODUCER-CONSUMER put() get() function prototypes
 
 // Data structure to track matrix production / consumption stats
-// sumtotal - total of all elements produced or consumed
+// sumtotal - total of all elements produced or consumed, 64-bit so long
+//            runs and large matrices don't wrap
 // multtotal - total number of matrices multiplied
 // matrixtotal - total number of matrices produced or consumed
+// putWait, getWait - time spent in each put_batch()/get_batch() call (BENCH_MODE)
+// residency - time from put() to the get() that took each matrix (BENCH_MODE)
+// The rest is where the thread spent its time, all times in nanoseconds and
+// only measured with STATS_MODE; the wait and lock fields only move with the
+// mutex buffer engine.  Counts are kept in every mode.
 typedef struct prodcons
 {
-  int sumtotal;
+  int64_t sumtotal;
   int multtotal;
   int matrixtotal;
+  uint64_t fullWait;   // blocked waiting on not_full (futex wait queue or condition variable)
+  uint64_t emptyWait;  // blocked waiting on not_empty (futex wait queue or condition variable)
+  uint64_t lockHold;   // holding the bounded buffer mutex
+  uint64_t genTime;    // generating and summing matrices
+  uint64_t multTime;   // in MatrixMultiply(), including failed attempts
+  int lockAcquires;    // times the bounded buffer mutex was taken
+  int condWaits;       // waits on not_full/not_empty, either --wait mode
+  int spuriousWakeups; // wakeups that found the buffer still full/empty
+  int discarded;       // matrices freed without ever being multiplied
+  int stolen;          // pairs taken from another consumer's deque (STEAL_MODE)
+  int stolenLive;      // of those, taken before this consumer saw end of stream
+  int corrupt;         // matrices that failed the VERIFY_MODE check
+  WaitStats wait;      // futex wait queue activity (WAIT_FUTEX, sharded buffer)
+  Hist putWait;
+  Hist getWait;
+  Hist residency;
 } ProdConsStats;
 
+// Arguments handed to each worker thread
+typedef struct workerargs
+{
+  counter_t *counter;
+  int id;       // 0-based index among workers of the same kind
+  int nworkers; // number of workers of the same kind
+  int stage;    // STAGE_* this consumer runs (PIPELINE_MODE)
+} WorkerArgs;
+
 // PRODUCER-CONSUMER thread method function prototypes
 void *prod_worker(void *arg);
 void *cons_worker(void *arg);
 
 // Routines to add and remove matrices from the bounded buffer
 Matrix **initBoundedBuffer();
+void destroyBoundedBuffer();
 int put(Matrix *value);
 Matrix *get();
+int put_batch(Matrix **values, int n);
+int get_batch(Matrix **values, int max);
+int try_get_batch(Matrix **values, int max);
+Matrix *get_rows(int rows);
+void closeBoundedBuffer();
+void stopProduction();
+int productionStopped();
 Matrix *GenMatrixRandom();
 void init_cnt(counter_t *c);
+void init_stats(ProdConsStats *s);
+void add_stats(ProdConsStats *total, const ProdConsStats *s);
@@ -0,0 +1,263 @@
+/*
+ *  ringbuf module
+ *  Bounded lock-free multi-producer/multi-consumer ring
+ *
+ *  Every slot holds a sequence number.  A producer may fill slot (pos % cap)
+ *  once its sequence equals 2*pos, a consumer may empty it once the sequence
+ *  equals 2*pos + 1.  (Doubling keeps "full" and "free" distinct even for a
+ *  ring of capacity 1.)  Claiming a position is a single CAS on head or tail, so
+ *  there is no lock anywhere on the fast path.
+ *
+ *  Blocking put/get call the try_ routines and park on a futex as soon as
+ *  one attempt finds the ring full (or empty), after announcing themselves
+ *  and trying once more so a transfer in between is not missed.  There is
+ *  no spinning.  The futex words are bumped on every transfer, but
+ *  FUTEX_WAKE is only issued when someone is parked.
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+// Include only libraries for this module
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <unistd.h>
+#include <assert.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "ringbuf.h"
+
+static void futex_wait(atomic_uint *addr, unsigned int expected)
+{
+  // returns straight away if *addr has already moved on
+  syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+static void futex_wake(atomic_uint *addr, int count)
+{
+  syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+// Bump a futex word and wake up to count parked threads, if there are any
+static void ring_notify(atomic_uint *word, atomic_int *waiters, int count)
+{
+  atomic_fetch_add(word, 1);
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load(waiters) > 0)
+    futex_wake(word, count);
+}
+
+int ring_init(RingBuf *rb, size_t capacity)
+{
+  assert(capacity > 0);
+  rb->cells = (RingCell *)aligned_alloc(CACHE_LINE,
+                                        (sizeof(RingCell) * capacity + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE);
+  if (rb->cells == NULL)
+    return -1;
+  for (size_t i = 0; i < capacity; i++)
+  {
+    atomic_init(&rb->cells[i].seq, 2 * i);
+    rb->cells[i].data = NULL;
+  }
+  rb->capacity = capacity;
+  atomic_init(&rb->head, 0);
+  atomic_init(&rb->tail, 0);
+  atomic_init(&rb->notFull, 0);
+  atomic_init(&rb->putWaiters, 0);
+  atomic_init(&rb->notEmpty, 0);
+  atomic_init(&rb->getWaiters, 0);
+  atomic_init(&rb->closed, 0);
+  return 0;
+}
+
+void ring_destroy(RingBuf *rb)
+{
+  free(rb->cells);
+  rb->cells = NULL;
+}
+
+// Non-blocking enqueue, returns -1 when the ring is full
+int ring_try_put(RingBuf *rb, void *item)
+{
+  RingCell *cell;
+  size_t pos = atomic_load_explicit(&rb->head, memory_order_relaxed);
+  for (;;)
+  {
+    cell = &rb->cells[pos % rb->capacity];
+    size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+    intptr_t dif = (intptr_t)seq - (intptr_t)(2 * pos);
+    if (dif == 0)
+    {
+      if (atomic_compare_exchange_weak_explicit(&rb->head, &pos, pos + 1,
+                                                memory_order_relaxed, memory_order_relaxed))
+        break;
+    }
+    else if (dif < 0)
+    {
+      return -1; // slot still holds an item from the previous lap
+    }
+    else
+    {
+      pos = atomic_load_explicit(&rb->head, memory_order_relaxed);
+    }
+  }
+  cell->data = item;
+  atomic_store_explicit(&cell->seq, 2 * pos + 1, memory_order_release);
+  return 0;
+}
+
+// Non-blocking dequeue, returns NULL when the ring is empty
+void *ring_try_get(RingBuf *rb)
+{
+  RingCell *cell;
+  size_t pos = atomic_load_explicit(&rb->tail, memory_order_relaxed);
+  for (;;)
+  {
+    cell = &rb->cells[pos % rb->capacity];
+    size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+    intptr_t dif = (intptr_t)seq - (intptr_t)(2 * pos + 1);
+    if (dif == 0)
+    {
+      if (atomic_compare_exchange_weak_explicit(&rb->tail, &pos, pos + 1,
+                                                memory_order_relaxed, memory_order_relaxed))
+        break;
+    }
+    else if (dif < 0)
+    {
+      return NULL; // producer has not filled this slot yet
+    }
+    else
+    {
+      pos = atomic_load_explicit(&rb->tail, memory_order_relaxed);
+    }
+  }
+  void *item = cell->data;
+  atomic_store_explicit(&cell->seq, 2 * (pos + rb->capacity), memory_order_release);
+  return item;
+}
+
+// Blocking enqueue, parks on notFull while the ring is full
+int ring_put(RingBuf *rb, void *item)
+{
+  return ring_put_batch(rb, &item, 1) == 1 ? 0 : -1;
+}
+
+// Blocking dequeue, parks on notEmpty while the ring is empty.
+// Returns NULL once the ring has been closed and fully drained.
+void *ring_get(RingBuf *rb)
+{
+  void *item;
+  return ring_get_batch(rb, &item, 1) == 1 ? item : NULL;
+}
+
+// Blocking enqueue of n items.  Consumers are woken once for the whole
+// batch, or once per stretch queued before we have to park on a full ring.
+int ring_put_batch(RingBuf *rb, void **items, int n)
+{
+  for (int i = 0; i < n; i++)
+  {
+    if (items[i] == NULL)
+      return -1; // NULL is reserved for "closed and drained"
+  }
+
+  int done = 0;
+  int announced = 0; // items consumers have already been told about
+  while (done < n)
+  {
+    if (ring_try_put(rb, items[done]) == 0)
+    {
+      done++;
+      continue;
+    }
+
+    // full: publish what we queued so far before going to sleep
+    if (done > announced)
+    {
+      ring_notify(&rb->notEmpty, &rb->getWaiters, done - announced);
+      announced = done;
+    }
+
+    unsigned int seen = atomic_load(&rb->notFull);
+    atomic_fetch_add(&rb->putWaiters, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    // recheck after announcing ourselves, a get may have slipped in
+    if (ring_try_put(rb, items[done]) == 0)
+    {
+      atomic_fetch_sub(&rb->putWaiters, 1);
+      done++;
+      continue;
+    }
+    futex_wait(&rb->notFull, seen);
+    atomic_fetch_sub(&rb->putWaiters, 1);
+  }
+
+  if (done > announced)
+    ring_notify(&rb->notEmpty, &rb->getWaiters, done - announced);
+  return done;
+}
+
+// Blocking dequeue of up to max items.  Waits for the first item, then takes
+// whatever else is ready without waiting.  Producers are woken once for the
+// whole batch.  Returns 0 once the ring has been closed and fully drained.
+int ring_get_batch(RingBuf *rb, void **items, int max)
+{
+  void *item;
+  while ((item = ring_try_get(rb)) == NULL)
+  {
+    if (atomic_load(&rb->closed))
+    {
+      // a put may have landed just before the close
+      item = ring_try_get(rb);
+      if (item == NULL)
+        return 0;
+      break;
+    }
+
+    unsigned int seen = atomic_load(&rb->notEmpty);
+    atomic_fetch_add(&rb->getWaiters, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    // recheck after announcing ourselves, a put may have slipped in
+    item = ring_try_get(rb);
+    if (item != NULL)
+    {
+      atomic_fetch_sub(&rb->getWaiters, 1);
+      break;
+    }
+    if (!atomic_load(&rb->closed))
+      futex_wait(&rb->notEmpty, seen);
+    atomic_fetch_sub(&rb->getWaiters, 1);
+  }
+
+  int count = 0;
+  items[count++] = item;
+  while (count < max && (item = ring_try_get(rb)) != NULL)
+    items[count++] = item;
+
+  ring_notify(&rb->notFull, &rb->putWaiters, count);
+  return count;
+}
+
+// Non-blocking dequeue of up to max items, returns how many (0 if the ring
+// is empty right now, closed or not)
+int ring_try_get_batch(RingBuf *rb, void **items, int max)
+{
+  int count = 0;
+  void *item;
+  while (count < max && (item = ring_try_get(rb)) != NULL)
+    items[count++] = item;
+  if (count > 0)
+    ring_notify(&rb->notFull, &rb->putWaiters, count);
+  return count;
+}
+
+// Mark end of stream and release every parked consumer
+void ring_close(RingBuf *rb)
+{
+  atomic_store(&rb->closed, 1);
+  atomic_fetch_add(&rb->notEmpty, 1);
+  futex_wake(&rb->notEmpty, INT_MAX);
+}
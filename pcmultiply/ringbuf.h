@@ -0,0 +1,51 @@
+/*
+ *  ringbuf header
+ *  Function prototypes, data, and constants for the lock-free ring module
+ *
+ *  Bounded multi-producer/multi-consumer queue of pointers (D. Vyukov's
+ *  sequence-numbered ring).  Threads only touch the futex when a try finds
+ *  the ring full or empty, and then park right away instead of spinning.
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+#define CACHE_LINE 64
+
+// Each slot carries a sequence number telling producers and consumers
+// whose turn it is to use the slot
+typedef struct ringcell
+{
+  atomic_size_t seq;
+  void *data;
+} RingCell;
+
+// head/tail and the two futex words each sit on their own cache line so
+// producers and consumers do not false-share
+typedef struct ringbuf
+{
+  RingCell *cells;
+  size_t capacity;
+  _Alignas(CACHE_LINE) atomic_size_t head; // next position to enqueue
+  _Alignas(CACHE_LINE) atomic_size_t tail; // next position to dequeue
+  _Alignas(CACHE_LINE) atomic_uint notFull; // bumped on every get
+  atomic_int putWaiters;
+  _Alignas(CACHE_LINE) atomic_uint notEmpty; // bumped on every put
+  atomic_int getWaiters;
+  atomic_int closed;
+} RingBuf;
+
+// RING ROUTINES
+int ring_init(RingBuf *rb, size_t capacity);
+void ring_destroy(RingBuf *rb);
+int ring_try_put(RingBuf *rb, void *item);
+void *ring_try_get(RingBuf *rb);
+int ring_put(RingBuf *rb, void *item);
+void *ring_get(RingBuf *rb);
+int ring_put_batch(RingBuf *rb, void **items, int n);
+int ring_get_batch(RingBuf *rb, void **items, int max);
+int ring_try_get_batch(RingBuf *rb, void **items, int max);
+void ring_close(RingBuf *rb);
@@ -0,0 +1,102 @@
+/*
+ *  rng module
+ *  Per-thread reproducible random numbers
+ *
+ *  Replaces rand(), whose hidden lock serialized every producer and whose
+ *  output depended on thread interleaving.  Each thread owns a PCG32
+ *  generator seeded from (seed, stream) so a run can be repeated exactly.
+ *
+ *  Bulk fills draw one 32-bit key from the thread's generator and then hash
+ *  (key, index) per element.  Elements do not depend on each other, so the
+ *  fill loop is plain 32-bit integer arithmetic the compiler can vectorize.
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+// Include only libraries for this module
+#include <stdio.h>
+#include <stdint.h>
+#include "rng.h"
+
+#define PCG_MULT 6364136223846793005ULL
+
+static __thread Rng myRng;
+static __thread int myRngSeeded = 0;
+
+uint32_t rng_next(Rng *r)
+{
+  uint64_t old = r->state;
+  r->state = old * PCG_MULT + r->inc;
+  uint32_t xorshifted = (uint32_t)(((old >> 18u) ^ old) >> 27u);
+  uint32_t rot = (uint32_t)(old >> 59u);
+  return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+}
+
+void rng_seed(Rng *r, uint64_t seed, uint64_t stream)
+{
+  r->state = 0;
+  r->inc = (stream << 1u) | 1u;
+  rng_next(r);
+  r->state += seed;
+  rng_next(r);
+}
+
+// Uniform integer in [lo, hi]
+int rng_range(Rng *r, int lo, int hi)
+{
+  uint32_t span = (uint32_t)(hi - lo) + 1;
+  return lo + (int)(((uint64_t)rng_next(r) * span) >> 32);
+}
+
+// 32-bit finalizer (lowbias32), turns a counter into a well mixed value
+static inline uint32_t mix32(uint32_t x)
+{
+  x ^= x >> 16;
+  x *= 0x7feb352du;
+  x ^= x >> 15;
+  x *= 0x846ca68bu;
+  x ^= x >> 16;
+  return x;
+}
+
+// Hash for element i of a fill keyed by key, scaled into [lo, lo + span)
+static inline int fill_value(uint32_t key, int i, int lo, uint32_t span)
+{
+  uint32_t h = mix32(key ^ ((uint32_t)i * 0x9e3779b9u));
+  return lo + (int)(((h >> 16) * span) >> 16);
+}
+
+// Fill dst[0..n) with integers in [lo, hi].  The range must fit in 16 bits;
+// the top 16 bits of each hash are scaled into it.  -O2 only vectorizes
+// loops that need no scalar epilogue, so the bulk goes in fixed blocks of
+// RNG_FILL_BLOCK and the remainder one at a time.
+#define RNG_FILL_BLOCK 8
+void rng_fill(Rng *r, int *dst, int n, int lo, int hi)
+{
+  uint32_t key = rng_next(r);
+  uint32_t span = (uint32_t)(hi - lo) + 1;
+  int i = 0;
+  for (; i + RNG_FILL_BLOCK <= n; i += RNG_FILL_BLOCK)
+  {
+    for (int k = 0; k < RNG_FILL_BLOCK; k++)
+      dst[i + k] = fill_value(key, i + k, lo, span);
+  }
+  for (; i < n; i++)
+    dst[i] = fill_value(key, i, lo, span);
+}
+
+// This thread's generator.  Threads that never called rng_thread_seed()
+// get stream 0 of seed 0.
+Rng *rng_thread()
+{
+  if (!myRngSeeded)
+    rng_thread_seed(0, 0);
+  return &myRng;
+}
+
+void rng_thread_seed(uint64_t seed, uint64_t stream)
+{
+  rng_seed(&myRng, seed, stream);
+  myRngSeeded = 1;
+}
@@ -0,0 +1,25 @@
+/*
+ *  rng header
+ *  Function prototypes and data for the random number module
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+#include <stdint.h>
+
+// PCG32 generator state (M. O'Neill, pcg-random.org).  Different stream
+// numbers give statistically independent sequences for the same seed.
+typedef struct rng
+{
+  uint64_t state;
+  uint64_t inc; // stream selector, always odd
+} Rng;
+
+// RNG ROUTINES
+void rng_seed(Rng *r, uint64_t seed, uint64_t stream);
+uint32_t rng_next(Rng *r);
+int rng_range(Rng *r, int lo, int hi);
+void rng_fill(Rng *r, int *dst, int n, int lo, int hi);
+Rng *rng_thread();
+void rng_thread_seed(uint64_t seed, uint64_t stream);
@@ -0,0 +1,219 @@
+/*
+ *  route module
+ *  Bounded buffer that keeps a separate queue per matrix row count
+ *
+ *  With one FIFO a consumer holding m1 has to dequeue and throw away
+ *  matrices until one with rows == m1->cols comes along.  Here every
+ *  matrix is routed by its row count, so the consumer asks for exactly the
+ *  partner it needs with route_get_rows() and the first matrix it gets
+ *  fits.  m1 itself is taken with route_get_batch(), from whichever queue
+ *  is longest so no row count builds up.
+ *
+ *  A consumer waiting for a row count nobody is producing must not stall
+ *  the pipeline.  Once the buffer is full (producers cannot add the
+ *  partner) or closed (nobody will), route_get_rows() hands out the oldest
+ *  matrix of the longest queue instead.  The caller sees it does not fit
+ *  and discards it, exactly as it would have with one FIFO.
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+// Include only libraries for this module
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "matrix.h"
+#include "route.h"
+
+int route_init(RouteBuf *rb, int capacity)
+{
+  assert(capacity > 0);
+  pthread_mutex_init(&rb->lock, NULL);
+  pthread_cond_init(&rb->notFull, NULL);
+  pthread_cond_init(&rb->anyReady, NULL);
+  for (int k = 0; k < ROUTE_KEYS; k++)
+  {
+    pthread_cond_init(&rb->keyReady[k], NULL);
+    rb->keyWaiters[k] = 0;
+    // any one queue may end up holding the whole buffer
+    rb->queues[k].items = (Matrix **)malloc(sizeof(Matrix *) * capacity);
+    if (rb->queues[k].items == NULL)
+    {
+      // undo the queues set up so far
+      for (int j = 0; j <= k; j++)
+        pthread_cond_destroy(&rb->keyReady[j]);
+      for (int j = 0; j < k; j++)
+        free(rb->queues[j].items);
+      pthread_cond_destroy(&rb->anyReady);
+      pthread_cond_destroy(&rb->notFull);
+      pthread_mutex_destroy(&rb->lock);
+      return -1;
+    }
+    rb->queues[k].head = 0;
+    rb->queues[k].tail = 0;
+    rb->queues[k].count = 0;
+  }
+  rb->count = 0;
+  rb->capacity = capacity;
+  rb->closed = 0;
+  return 0;
+}
+
+void route_destroy(RouteBuf *rb)
+{
+  for (int k = 0; k < ROUTE_KEYS; k++)
+  {
+    pthread_cond_destroy(&rb->keyReady[k]);
+    free(rb->queues[k].items);
+  }
+  pthread_cond_destroy(&rb->anyReady);
+  pthread_cond_destroy(&rb->notFull);
+  pthread_mutex_destroy(&rb->lock);
+}
+
+// Remove the oldest matrix of queue k, lock held and queue non-empty
+static Matrix *take(RouteBuf *rb, int k)
+{
+  RouteQueue *q = &rb->queues[k];
+  Matrix *m = q->items[q->tail];
+  q->tail = (q->tail + 1) % rb->capacity;
+  q->count--;
+  rb->count--;
+  return m;
+}
+
+// Index of the longest queue, lock held and buffer non-empty
+static int longest(RouteBuf *rb)
+{
+  int best = 0;
+  for (int k = 1; k < ROUTE_KEYS; k++)
+  {
+    if (rb->queues[k].count > rb->queues[best].count)
+      best = k;
+  }
+  return best;
+}
+
+// Queue n matrices by row count, blocking while the buffer is full.
+// Wakes a consumer waiting for each matrix's rows, or else one waiting for
+// anything.  Returns n.
+int route_put_batch(RouteBuf *rb, Matrix **items, int n)
+{
+  pthread_mutex_lock(&rb->lock);
+  for (int i = 0; i < n; i++)
+  {
+    while (rb->count == rb->capacity)
+      pthread_cond_wait(&rb->notFull, &rb->lock);
+
+    int k = ROUTE_KEY(items[i]->rows);
+    RouteQueue *q = &rb->queues[k];
+    q->items[q->head] = items[i];
+    q->head = (q->head + 1) % rb->capacity;
+    q->count++;
+    rb->count++;
+
+    if (rb->keyWaiters[k] > 0)
+      pthread_cond_signal(&rb->keyReady[k]);
+    else
+      pthread_cond_signal(&rb->anyReady);
+
+    if (rb->count == rb->capacity)
+    {
+      // just filled up: consumers waiting on a row count have to settle
+      // for anything now, or producers and consumers wait on each other
+      for (int j = 0; j < ROUTE_KEYS; j++)
+      {
+        if (rb->keyWaiters[j] > 0)
+          pthread_cond_broadcast(&rb->keyReady[j]);
+      }
+    }
+  }
+  pthread_mutex_unlock(&rb->lock);
+  return n;
+}
+
+// Take up to max matrices from the longest queue and release the lock.
+// Called with the lock held and the buffer not empty.
+static int take_longest(RouteBuf *rb, Matrix **items, int max)
+{
+  int k = longest(rb);
+  int count = 0;
+  while (count < max && rb->queues[k].count > 0)
+    items[count++] = take(rb, k);
+
+  pthread_cond_broadcast(&rb->notFull);
+  // pass the baton if matrices are left for another waiting consumer
+  if (rb->count > 0)
+    pthread_cond_signal(&rb->anyReady);
+  pthread_mutex_unlock(&rb->lock);
+  return count;
+}
+
+// Dequeue up to max matrices from the longest queue, blocking while the
+// buffer is empty.  Returns 0 once it is closed and drained.
+int route_get_batch(RouteBuf *rb, Matrix **items, int max)
+{
+  pthread_mutex_lock(&rb->lock);
+  while (rb->count == 0)
+  {
+    if (rb->closed)
+    {
+      pthread_mutex_unlock(&rb->lock);
+      return 0;
+    }
+    pthread_cond_wait(&rb->anyReady, &rb->lock);
+  }
+
+  return take_longest(rb, items, max);
+}
+
+// Non-blocking route_get_batch(), returns 0 if the buffer is empty right now
+int route_try_get_batch(RouteBuf *rb, Matrix **items, int max)
+{
+  pthread_mutex_lock(&rb->lock);
+  if (rb->count == 0)
+  {
+    pthread_mutex_unlock(&rb->lock);
+    return 0;
+  }
+  return take_longest(rb, items, max);
+}
+
+// Dequeue the oldest matrix with the given row count, waiting for one to
+// be produced.  If the buffer fills up or is closed while none is queued,
+// takes the oldest matrix of the longest queue instead (the caller must
+// check rows).  Returns NULL once the buffer is closed and drained.
+Matrix *route_get_rows(RouteBuf *rb, int rows)
+{
+  int k = ROUTE_KEY(rows);
+  pthread_mutex_lock(&rb->lock);
+  while (rb->queues[k].count == 0 && rb->count < rb->capacity && !rb->closed)
+  {
+    rb->keyWaiters[k]++;
+    pthread_cond_wait(&rb->keyReady[k], &rb->lock);
+    rb->keyWaiters[k]--;
+  }
+
+  Matrix *m = NULL;
+  if (rb->queues[k].count > 0)
+    m = take(rb, k);
+  else if (rb->count > 0)
+    m = take(rb, longest(rb));
+
+  if (m != NULL)
+    pthread_cond_signal(&rb->notFull);
+  pthread_mutex_unlock(&rb->lock);
+  return m;
+}
+
+// Mark end of stream and release every waiting consumer
+void route_close(RouteBuf *rb)
+{
+  pthread_mutex_lock(&rb->lock);
+  rb->closed = 1;
+  pthread_cond_broadcast(&rb->anyReady);
+  for (int k = 0; k < ROUTE_KEYS; k++)
+    pthread_cond_broadcast(&rb->keyReady[k]);
+  pthread_mutex_unlock(&rb->lock);
+}
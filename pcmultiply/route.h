@@ -0,0 +1,46 @@
+/*
+ *  route header
+ *  Function prototypes, data, and constants for the routed buffer module
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+#include <pthread.h>
+
+// Matrices with rows < ROUTE_KEYS get a queue each, taller ones share
+// queue 0 and may still need checking after they are taken
+#define ROUTE_KEYS 16
+#define ROUTE_KEY(rows) ((rows) < ROUTE_KEYS ? (rows) : 0)
+
+// FIFO of the matrices with one row count
+typedef struct routequeue
+{
+  Matrix **items;
+  int head;
+  int tail;
+  int count;
+} RouteQueue;
+
+// Bounded buffer of per-rows queues.  capacity bounds all queues together.
+typedef struct routebuf
+{
+  pthread_mutex_t lock;
+  pthread_cond_t notFull;
+  pthread_cond_t anyReady;             // consumers taking any matrix
+  pthread_cond_t keyReady[ROUTE_KEYS]; // consumers waiting for one row count
+  int keyWaiters[ROUTE_KEYS];
+  RouteQueue queues[ROUTE_KEYS];
+  int count;
+  int capacity;
+  int closed;
+} RouteBuf;
+
+// ROUTED BUFFER ROUTINES
+int route_init(RouteBuf *rb, int capacity);
+void route_destroy(RouteBuf *rb);
+int route_put_batch(RouteBuf *rb, Matrix **items, int n);
+int route_get_batch(RouteBuf *rb, Matrix **items, int max);
+int route_try_get_batch(RouteBuf *rb, Matrix **items, int max);
+Matrix *route_get_rows(RouteBuf *rb, int rows);
+void route_close(RouteBuf *rb);
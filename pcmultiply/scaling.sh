@@ -0,0 +1,36 @@
+#!/bin/sh
+#
+# Throughput vs. thread count report for pcMatrix
+#
+# Runs pcMatrix once per worker thread count and prints one line per run.
+# Runs are quiet (-q), so the times measure the workers and not formatting
+# every matrix to stdout.  pcMatrix options given here come after -q, so
+# e.g. --verbose=2 still turns per-matrix output back on.
+#
+# usage: ./scaling.sh [max_threads [bounded_buffer_size [matricies [matrix_mode [pcMatrix options...]]]]]
+#
+# University of Washington, Tacoma
+# TCSS 422 - Operating Systems
+
+MAXW=${1:-16}
+BUF=${2:-200}
+LOOPS=${3:-1200}
+MODE=${4:-0}
+if [ $# -ge 4 ]; then shift 4; else shift $#; fi
+
+printf "%8s %10s %16s %8s %8s\n" threads elapsed_s matrices_per_sec speedup check
+base=""
+w=1
+while [ "$w" -le "$MAXW" ]; do
+  out=$(./pcMatrix -q "$@" "$w" "$BUF" "$LOOPS" "$MODE" | grep -E '^(Sum of|Matrices|Elapsed)')
+  elapsed=$(echo "$out" | sed -n 's/^Elapsed=\([0-9.]*\)s.*/\1/p')
+  rate=$(echo "$out" | sed -n 's/.*Throughput=\([0-9]*\) .*/\1/p')
+  prod=$(echo "$out" | sed -n 's/.*Produced=\(-*[0-9]*\) .*/\1/p')
+  cons=$(echo "$out" | sed -n 's/.*Consumed=\(-*[0-9]*\)$/\1/p')
+  [ -z "$base" ] && base=$rate
+  check=ok
+  [ "$prod" = "$cons" ] || check=MISMATCH
+  printf "%8d %10s %16s %8s %8s\n" "$w" "$elapsed" "$rate" \
+    "$(awk -v r="$rate" -v b="$base" 'BEGIN { if (b > 0) printf "%.2fx", r / b; else print "-" }')" "$check"
+  w=$((w * 2))
+done
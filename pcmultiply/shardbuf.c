@@ -0,0 +1,205 @@
+/*
+ *  shardbuf module
+ *  Bounded buffer split into independently locked shards
+ *
+ *  The total capacity is dealt out over K small rings, each with its own
+ *  mutex.  A thread works its home shard first (chosen from its worker
+ *  index, so threads spread evenly) and moves on to the other shards when
+ *  the home one is full for a producer or empty for a consumer.  In the
+ *  common case two threads only touch the same lock when they share a home
+ *  shard or one is stealing from the other.
+ *
+ *  Parking is shared.  A put to any shard has to be able to wake a
+ *  consumer homed anywhere else, so threads that found every shard full
+ *  (or empty) sleep on one pair of futex wait queues (waitq.c).  A put of
+ *  n matrices wakes at most n parked consumers, a get of n at most n
+ *  parked producers, and neither makes a syscall when nobody is parked.
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+// Include only libraries for this module
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "waitq.h"
+#include "shardbuf.h"
+
+// Deal capacity out over nshards rings (fewer if capacity is smaller)
+int shard_init(ShardBuf *sb, int nshards, int capacity)
+{
+  assert(nshards > 0 && capacity > 0);
+  if (nshards > capacity)
+    nshards = capacity;
+  sb->shards = (Shard *)aligned_alloc(SHARD_CACHE_LINE, sizeof(Shard) * nshards);
+  if (sb->shards == NULL)
+    return -1;
+  sb->nshards = nshards;
+  for (int i = 0; i < nshards; i++)
+  {
+    Shard *s = &sb->shards[i];
+    pthread_mutex_init(&s->lock, NULL);
+    s->capacity = capacity / nshards + (i < capacity % nshards);
+    s->items = (void **)malloc(sizeof(void *) * s->capacity);
+    if (s->items == NULL)
+    {
+      // undo the shards set up so far
+      for (int j = 0; j < i; j++)
+      {
+        pthread_mutex_destroy(&sb->shards[j].lock);
+        free(sb->shards[j].items);
+      }
+      pthread_mutex_destroy(&s->lock);
+      free(sb->shards);
+      sb->shards = NULL;
+      return -1;
+    }
+    s->head = 0;
+    s->tail = 0;
+    s->count = 0;
+  }
+  waitq_init(&sb->notFull);
+  waitq_init(&sb->notEmpty);
+  atomic_init(&sb->closed, 0);
+  return 0;
+}
+
+void shard_destroy(ShardBuf *sb)
+{
+  for (int i = 0; i < sb->nshards; i++)
+  {
+    pthread_mutex_destroy(&sb->shards[i].lock);
+    free(sb->shards[i].items);
+  }
+  free(sb->shards);
+  sb->shards = NULL;
+}
+
+// Move as many of items[0..n) into shard s as fit, returns how many did
+static int shard_try_put(Shard *s, void **items, int n)
+{
+  int done = 0;
+  pthread_mutex_lock(&s->lock);
+  while (done < n && s->count < s->capacity)
+  {
+    s->items[s->head] = items[done++];
+    s->head = (s->head + 1) % s->capacity;
+    s->count++;
+  }
+  pthread_mutex_unlock(&s->lock);
+  return done;
+}
+
+// Take up to max items from shard s, returns how many
+static int shard_try_get(Shard *s, void **items, int max)
+{
+  int count = 0;
+  pthread_mutex_lock(&s->lock);
+  while (count < max && s->count > 0)
+  {
+    items[count++] = s->items[s->tail];
+    s->tail = (s->tail + 1) % s->capacity;
+    s->count--;
+  }
+  pthread_mutex_unlock(&s->lock);
+  return count;
+}
+
+// One pass over every shard starting at home, putting what fits
+static int put_scan(ShardBuf *sb, int home, void **items, int n)
+{
+  int done = 0;
+  for (int k = 0; k < sb->nshards && done < n; k++)
+    done += shard_try_put(&sb->shards[(home + k) % sb->nshards], items + done, n - done);
+  return done;
+}
+
+// One pass over every shard starting at home, stopping at the first
+// shard that has anything
+static int get_scan(ShardBuf *sb, int home, void **items, int max)
+{
+  for (int k = 0; k < sb->nshards; k++)
+  {
+    int count = shard_try_get(&sb->shards[(home + k) % sb->nshards], items, max);
+    if (count > 0)
+      return count;
+  }
+  return 0;
+}
+
+// Queue n items, home shard first, then any other shard with room.
+// Blocks while every shard is full.  Returns n.
+int shard_put_batch(ShardBuf *sb, int home, void **items, int n)
+{
+  home %= sb->nshards;
+  int done = put_scan(sb, home, items, n);
+  int notified = 0;
+  while (done < n)
+  {
+    // every shard was full, let consumers at what we queued and park
+    waitq_notify(&sb->notEmpty, done - notified);
+    notified = done;
+
+    unsigned int ticket = waitq_prepare(&sb->notFull);
+    // recheck after announcing ourselves, a get may have slipped in
+    int more = put_scan(sb, home, items + done, n - done);
+    if (more == 0)
+      waitq_wait(&sb->notFull, ticket);
+    else
+      waitq_cancel(&sb->notFull);
+
+    done += more;
+    if (done < n)
+      done += put_scan(sb, home, items + done, n - done);
+  }
+  waitq_notify(&sb->notEmpty, done - notified);
+  return done;
+}
+
+// Dequeue up to max items from one shard, the home shard if it has any,
+// otherwise the first other shard that does.  Blocks while every shard is
+// empty.  Returns 0 once the buffer is closed and every shard has drained.
+int shard_get_batch(ShardBuf *sb, int home, void **items, int max)
+{
+  home %= sb->nshards;
+  int count;
+  while ((count = get_scan(sb, home, items, max)) == 0)
+  {
+    unsigned int ticket = waitq_prepare(&sb->notEmpty);
+    // recheck after announcing ourselves, a put or the close may have
+    // slipped in
+    count = get_scan(sb, home, items, max);
+    int closed = atomic_load(&sb->closed);
+    if (count == 0 && !closed)
+      waitq_wait(&sb->notEmpty, ticket);
+    else
+      waitq_cancel(&sb->notEmpty);
+
+    if (count > 0)
+      break;
+    if (closed)
+    {
+      // every put landed before the close, one last look
+      return get_scan(sb, home, items, max);
+    }
+  }
+  waitq_notify(&sb->notFull, count);
+  return count;
+}
+
+// Non-blocking shard_get_batch(), returns 0 if every shard is empty right now
+int shard_try_get_batch(ShardBuf *sb, int home, void **items, int max)
+{
+  int count = get_scan(sb, home % sb->nshards, items, max);
+  if (count > 0)
+    waitq_notify(&sb->notFull, count);
+  return count;
+}
+
+// Mark end of stream and release every parked consumer
+void shard_close(ShardBuf *sb)
+{
+  atomic_store(&sb->closed, 1);
+  waitq_notify_all(&sb->notEmpty);
+}
@@ -0,0 +1,43 @@
+/*
+ *  shardbuf header
+ *  Function prototypes, data, and constants for the sharded buffer module
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define SHARD_CACHE_LINE 64
+
+// One independent ring.  Each shard sits on its own cache lines so threads
+// working different shards never share a line.
+typedef struct shard
+{
+  _Alignas(SHARD_CACHE_LINE) pthread_mutex_t lock;
+  void **items;
+  int capacity;
+  int head; // next slot to fill
+  int tail; // next slot to empty
+  int count;
+} Shard;
+
+// K shards whose capacities add up to the bounded buffer size.  Threads
+// only meet on park/wake, when every shard is full (or empty).
+typedef struct shardbuf
+{
+  Shard *shards;
+  int nshards;
+  WaitQ notFull;  // producers that found every shard full
+  WaitQ notEmpty; // consumers that found every shard empty
+  atomic_int closed;
+} ShardBuf;
+
+// SHARDED BUFFER ROUTINES
+int shard_init(ShardBuf *sb, int nshards, int capacity);
+void shard_destroy(ShardBuf *sb);
+int shard_put_batch(ShardBuf *sb, int home, void **items, int n);
+int shard_get_batch(ShardBuf *sb, int home, void **items, int max);
+int shard_try_get_batch(ShardBuf *sb, int home, void **items, int max);
+void shard_close(ShardBuf *sb);
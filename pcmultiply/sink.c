@@ -0,0 +1,317 @@
+/*
+ *  sink module
+ *  Binary result file with asynchronous write-behind
+ *
+ *  Products are written in the matfile.c format, so a result file can be
+ *  fed straight back in with --input.  By default only m3 is kept; with
+ *  factors every result is the three records m1, m2, m3.
+ *
+ *  Consumers never write to the file themselves.  SinkWrite() copies the
+ *  records into the calling thread's active staging buffer.  When that
+ *  fills, the buffer is queued for the writer thread and the consumer moves
+ *  on to its second buffer, so it only ever waits if the writer is a whole
+ *  buffer behind.  The writer takes everything queued and writes it with
+ *  one writev() per SINK_MAX_IOV buffers.
+ *
+ *  The record count in the file header is patched in by SinkStop().  It
+ *  also reports a checksum for checking a replay against the original run:
+ *  the CRC32C of every product record (dims and elements), added up.  The
+ *  CRC catches reordered or offsetting elements within a product.  Adding
+ *  the CRCs up makes the total independent of the order consumers finish
+ *  in, which varies from run to run.
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+// Include only libraries for this module
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include "matrix.h"
+#include "matfile.h"
+#include "crc32c.h"
+#include "sink.h"
+
+typedef struct sinkbuf
+{
+  struct sinkbuf *next; // writer queue
+  char *data;
+  size_t len;
+  size_t cap;
+  int busy; // queued or being written, owner must not touch it
+} SinkBuf;
+
+static int sinkFd = -1;
+static int sinkFactors;
+static pthread_t sinkThread;
+static const char *sinkPath;
+static int sinkFailed; // a write failed, reported by SinkStop()
+
+// buffers waiting for the writer thread
+static pthread_mutex_t sinkLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sinkQueued = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t sinkWritten = PTHREAD_COND_INITIALIZER;
+static SinkBuf *sinkHead, *sinkTail;
+static int sinkStopping;
+
+// totals, folded in by each thread on SinkFlushThread()
+static atomic_long sinkRecords;
+static atomic_long sinkProducts;
+static _Atomic uint64_t sinkChecksum;
+
+// this thread's staging buffers
+static __thread SinkBuf *myBufs[2];
+static __thread int myActive;
+static __thread long myRecords;
+static __thread long myProducts;
+static __thread uint64_t myChecksum;
+
+// write all of iov, short writes included
+static int write_all(struct iovec *iov, int n)
+{
+  while (n > 0)
+  {
+    ssize_t w = writev(sinkFd, iov, n);
+    if (w < 0)
+      return -1;
+    while (n > 0 && (size_t)w >= iov->iov_len)
+    {
+      w -= iov->iov_len;
+      iov++;
+      n--;
+    }
+    if (n > 0)
+    {
+      iov->iov_base = (char *)iov->iov_base + w;
+      iov->iov_len -= w;
+    }
+  }
+  return 0;
+}
+
+static void *sink_worker(void *arg)
+{
+  (void)arg;
+  pthread_mutex_lock(&sinkLock);
+  for (;;)
+  {
+    while (sinkHead == NULL && !sinkStopping)
+      pthread_cond_wait(&sinkQueued, &sinkLock);
+    if (sinkHead == NULL)
+      break; // stopping and fully drained
+
+    // take the whole queue and write it without holding the lock
+    SinkBuf *bufs = sinkHead;
+    sinkHead = sinkTail = NULL;
+    pthread_mutex_unlock(&sinkLock);
+
+    SinkBuf *b = bufs;
+    while (b != NULL)
+    {
+      struct iovec iov[SINK_MAX_IOV];
+      int n = 0;
+      for (SinkBuf *c = b; c != NULL && n < SINK_MAX_IOV; c = c->next)
+      {
+        iov[n].iov_base = c->data;
+        iov[n].iov_len = c->len;
+        n++;
+      }
+      if (write_all(iov, n) != 0)
+        sinkFailed = 1;
+
+      // hand the buffers back to their owners
+      pthread_mutex_lock(&sinkLock);
+      for (; n > 0; n--)
+      {
+        SinkBuf *next = b->next;
+        b->len = 0;
+        b->busy = 0;
+        b->next = NULL;
+        b = next;
+      }
+      pthread_cond_broadcast(&sinkWritten);
+      pthread_mutex_unlock(&sinkLock);
+    }
+    pthread_mutex_lock(&sinkLock);
+  }
+  pthread_mutex_unlock(&sinkLock);
+  return NULL;
+}
+
+// Create path and start the writer thread.  withFactors keeps m1 and m2
+// with every product.  Returns -1 with a message on stderr on failure.
+int SinkStart(const char *path, int withFactors)
+{
+  sinkFd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (sinkFd < 0)
+  {
+    perror(path);
+    return -1;
+  }
+  // count is patched in by SinkStop()
+  MatFileHeader h = {MATFILE_MAGIC, 0};
+  if (write(sinkFd, &h, sizeof(h)) != sizeof(h))
+  {
+    perror(path);
+    close(sinkFd);
+    sinkFd = -1;
+    return -1;
+  }
+  sinkPath = path;
+  sinkFactors = withFactors;
+  sinkStopping = 0;
+  sinkFailed = 0;
+  pthread_create(&sinkThread, NULL, sink_worker, NULL);
+  return 0;
+}
+
+// Queue buffer b for the writer thread
+static void submit(SinkBuf *b)
+{
+  pthread_mutex_lock(&sinkLock);
+  b->busy = 1;
+  if (sinkTail != NULL)
+    sinkTail->next = b;
+  else
+    sinkHead = b;
+  sinkTail = b;
+  pthread_cond_signal(&sinkQueued);
+  pthread_mutex_unlock(&sinkLock);
+}
+
+// Wait until the writer has finished with b
+static void wait_idle(SinkBuf *b)
+{
+  pthread_mutex_lock(&sinkLock);
+  while (b->busy)
+    pthread_cond_wait(&sinkWritten, &sinkLock);
+  pthread_mutex_unlock(&sinkLock);
+}
+
+// Active staging buffer with room for bytes more, switching buffers first
+// if the active one cannot take them
+static SinkBuf *reserve(size_t bytes)
+{
+  if (myBufs[0] == NULL)
+  {
+    for (int i = 0; i < 2; i++)
+    {
+      myBufs[i] = (SinkBuf *)calloc(1, sizeof(SinkBuf));
+      myBufs[i]->cap = SINK_BUFFER_SIZE;
+      myBufs[i]->data = (char *)malloc(SINK_BUFFER_SIZE);
+    }
+    myActive = 0;
+  }
+
+  SinkBuf *b = myBufs[myActive];
+  if (b->len + bytes > b->cap && b->len > 0)
+  {
+    submit(b);
+    myActive ^= 1;
+    b = myBufs[myActive];
+    wait_idle(b); // only blocks if the writer is a whole buffer behind
+  }
+  if (bytes > b->cap)
+  {
+    // one record bigger than a buffer, grow this one to fit it
+    b->data = (char *)realloc(b->data, bytes);
+    b->cap = bytes;
+  }
+  return b;
+}
+
+// Append mat as one record, returns the CRC32C of the record as written
+static uint32_t append_record(SinkBuf *b, Matrix *mat)
+{
+  const char *start = b->data + b->len;
+  int32_t dims[2] = {mat->rows, mat->cols};
+  memcpy(b->data + b->len, dims, sizeof(dims));
+  b->len += sizeof(dims);
+
+  size_t rowBytes = (size_t)mat->cols * sizeof(int32_t);
+  for (int i = 0; i < mat->rows; i++)
+  {
+    memcpy(b->data + b->len, MROW(mat, i), rowBytes);
+    b->len += rowBytes;
+  }
+  myRecords++;
+  // over the staged copy, which is contiguous and still in cache
+  return crc32c(0, start, b->data + b->len - start);
+}
+
+static size_t record_size(Matrix *mat)
+{
+  return sizeof(MatRecord) + (size_t)mat->rows * mat->cols * sizeof(int32_t);
+}
+
+// Stage one result m1 x m2 = m3 for the writer thread
+void SinkWrite(Matrix *m1, Matrix *m2, Matrix *m3)
+{
+  if (sinkFd < 0)
+    return;
+  size_t bytes = record_size(m3);
+  if (sinkFactors)
+    bytes += record_size(m1) + record_size(m2);
+
+  SinkBuf *b = reserve(bytes);
+  if (sinkFactors)
+  {
+    append_record(b, m1);
+    append_record(b, m2);
+  }
+  myChecksum += append_record(b, m3);
+  myProducts++;
+}
+
+// Hand this thread's staged results to the writer and release its buffers.
+// Every thread that called SinkWrite() must call this before SinkStop().
+void SinkFlushThread()
+{
+  if (myBufs[0] == NULL)
+    return;
+  if (myBufs[myActive]->len > 0)
+    submit(myBufs[myActive]);
+  for (int i = 0; i < 2; i++)
+  {
+    wait_idle(myBufs[i]);
+    free(myBufs[i]->data);
+    free(myBufs[i]);
+    myBufs[i] = NULL;
+  }
+  atomic_fetch_add(&sinkRecords, myRecords);
+  atomic_fetch_add(&sinkProducts, myProducts);
+  atomic_fetch_add(&sinkChecksum, myChecksum);
+  myRecords = myProducts = 0;
+  myChecksum = 0;
+}
+
+// Drain and stop the writer, fill in the record count and close the file.
+// Reports the number of products and their checksum.
+void SinkStop(long *products, uint64_t *checksum)
+{
+  if (sinkFd < 0)
+    return;
+  pthread_mutex_lock(&sinkLock);
+  sinkStopping = 1;
+  pthread_cond_signal(&sinkQueued);
+  pthread_mutex_unlock(&sinkLock);
+  pthread_join(sinkThread, NULL);
+
+  int32_t count = (int32_t)atomic_load(&sinkRecords);
+  if (pwrite(sinkFd, &count, sizeof(count), offsetof(MatFileHeader, count)) != sizeof(count))
+    sinkFailed = 1;
+  if (close(sinkFd) != 0)
+    sinkFailed = 1;
+  sinkFd = -1;
+  if (sinkFailed)
+    fprintf(stderr, "%s: writing results failed\n", sinkPath);
+
+  *products = atomic_load(&sinkProducts);
+  *checksum = atomic_load(&sinkChecksum);
+}
@@ -0,0 +1,22 @@
+/*
+ *  sink header
+ *  Function prototypes, data, and constants for the result sink module
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+#include <stdint.h>
+
+// Each consumer fills one staging buffer while the writer thread drains its
+// other one.  A record bigger than this gets a buffer of its own size.
+#define SINK_BUFFER_SIZE (1024 * 1024)
+
+// Most staging buffers the writer hands to one writev()
+#define SINK_MAX_IOV 64
+
+// SINK ROUTINES
+int SinkStart(const char *path, int withFactors);
+void SinkWrite(Matrix *m1, Matrix *m2, Matrix *m3);
+void SinkFlushThread();
+void SinkStop(long *products, uint64_t *checksum);
@@ -0,0 +1,137 @@
+/*
+ *  steal module
+ *  Work-stealing deques of matrix pairs for the consumer pool
+ *
+ *  A consumer in steal mode pairs the matrices it dequeues from the bounded
+ *  buffer but does not multiply them straight away.  The pairs go onto its
+ *  own deque, which it keeps filling from the buffer until the deque is
+ *  full, and only then works through newest first.  That keeps up to a
+ *  deque's worth of pairs where idle peers can take the oldest, so one
+ *  consumer that happened to grab a run of pairs does not multiply them all
+ *  alone while the others sit idle.
+ *
+ *  Each deque has its own mutex.  A pair costs a whole multiplication, so
+ *  the lock is never the bottleneck and the owner and thieves only contend
+ *  when a deque is down to its last pair.
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+// Include only libraries for this module
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "matrix.h"
+#include "steal.h"
+
+StealPool *steal_create(int nworkers, int capacity)
+{
+  assert(nworkers > 0 && capacity > 0);
+  StealPool *sp = (StealPool *)malloc(sizeof(StealPool));
+  sp->deques = (PairDeque *)aligned_alloc(STEAL_CACHE_LINE, sizeof(PairDeque) * nworkers);
+  sp->count = nworkers;
+  for (int i = 0; i < nworkers; i++)
+  {
+    PairDeque *dq = &sp->deques[i];
+    pthread_mutex_init(&dq->lock, NULL);
+    dq->pairs = (MatrixPair *)malloc(sizeof(MatrixPair) * capacity);
+    dq->capacity = capacity;
+    atomic_init(&dq->top, 0);
+    atomic_init(&dq->bottom, 0);
+  }
+  return sp;
+}
+
+void steal_destroy(StealPool *sp)
+{
+  for (int i = 0; i < sp->count; i++)
+  {
+    pthread_mutex_destroy(&sp->deques[i].lock);
+    free(sp->deques[i].pairs);
+  }
+  free(sp->deques);
+  free(sp);
+}
+
+// Push a pair onto worker id's own deque.  Returns 0, or -1 if it is full.
+int steal_push(StealPool *sp, int id, MatrixPair pair)
+{
+  PairDeque *dq = &sp->deques[id];
+  int rc = -1;
+  pthread_mutex_lock(&dq->lock);
+  int top = atomic_load_explicit(&dq->top, memory_order_relaxed);
+  int bottom = atomic_load_explicit(&dq->bottom, memory_order_relaxed);
+  if (bottom == dq->capacity && top > 0)
+  {
+    // thieves have freed the front, slide what is left down to make room
+    memmove(dq->pairs, dq->pairs + top, sizeof(MatrixPair) * (bottom - top));
+    bottom -= top;
+    atomic_store_explicit(&dq->top, 0, memory_order_relaxed);
+    atomic_store_explicit(&dq->bottom, bottom, memory_order_relaxed);
+  }
+  if (bottom < dq->capacity)
+  {
+    dq->pairs[bottom] = pair;
+    atomic_store_explicit(&dq->bottom, bottom + 1, memory_order_relaxed);
+    rc = 0;
+  }
+  pthread_mutex_unlock(&dq->lock);
+  return rc;
+}
+
+// Owner side: newest pair from worker id's own deque.  Returns 1 if one
+// was found, 0 if the deque is empty.
+int steal_pop(StealPool *sp, int id, MatrixPair *pair)
+{
+  PairDeque *dq = &sp->deques[id];
+  int found = 0;
+  pthread_mutex_lock(&dq->lock);
+  int bottom = atomic_load_explicit(&dq->bottom, memory_order_relaxed);
+  if (atomic_load_explicit(&dq->top, memory_order_relaxed) < bottom)
+  {
+    *pair = dq->pairs[bottom - 1];
+    atomic_store_explicit(&dq->bottom, bottom - 1, memory_order_relaxed);
+    found = 1;
+  }
+  pthread_mutex_unlock(&dq->lock);
+  return found;
+}
+
+// Thief side: oldest pair from the first peer of worker id that has one,
+// starting with the next worker up so thieves spread over their victims.
+// Returns 1 if a pair was stolen, 0 if every peer was empty.
+int steal_take(StealPool *sp, int id, MatrixPair *pair)
+{
+  for (int k = 1; k < sp->count; k++)
+  {
+    PairDeque *dq = &sp->deques[(id + k) % sp->count];
+
+    // unlocked peek, skip empty deques without touching their lock
+    if (atomic_load_explicit(&dq->top, memory_order_relaxed) >= atomic_load_explicit(&dq->bottom, memory_order_relaxed))
+      continue;
+
+    int found = 0;
+    pthread_mutex_lock(&dq->lock);
+    int top = atomic_load_explicit(&dq->top, memory_order_relaxed);
+    if (top < atomic_load_explicit(&dq->bottom, memory_order_relaxed))
+    {
+      *pair = dq->pairs[top];
+      atomic_store_explicit(&dq->top, top + 1, memory_order_relaxed);
+      found = 1;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    if (found)
+      return 1;
+  }
+  return 0;
+}
+
+// Pairs on worker id's deque.  Unlocked, so only a hint once peers steal.
+int steal_size(StealPool *sp, int id)
+{
+  PairDeque *dq = &sp->deques[id];
+  int n = atomic_load_explicit(&dq->bottom, memory_order_relaxed) - atomic_load_explicit(&dq->top, memory_order_relaxed);
+  return n > 0 ? n : 0;
+}
@@ -0,0 +1,46 @@
+/*
+ *  steal header
+ *  Function prototypes, data, and constants for the work-stealing module
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define STEAL_CACHE_LINE 64
+
+// One multiplication waiting to be done, m1 x m2
+typedef struct matrixpair
+{
+  Matrix *m1;
+  Matrix *m2;
+} MatrixPair;
+
+// Per-consumer deque of pairs.  The owner pushes and pops at the bottom,
+// thieves take from the top.  Each deque sits on its own cache lines.
+// top and bottom only change under the lock but are atomic, so thieves can
+// peek at them without it.
+typedef struct pairdeque
+{
+  _Alignas(STEAL_CACHE_LINE) pthread_mutex_t lock;
+  MatrixPair *pairs;
+  int capacity;
+  atomic_int top;    // oldest pair, next one a thief takes
+  atomic_int bottom; // one past the newest pair
+} PairDeque;
+
+typedef struct stealpool
+{
+  PairDeque *deques;
+  int count;
+} StealPool;
+
+// STEAL ROUTINES
+StealPool *steal_create(int nworkers, int capacity);
+void steal_destroy(StealPool *sp);
+int steal_push(StealPool *sp, int id, MatrixPair pair);
+int steal_pop(StealPool *sp, int id, MatrixPair *pair);
+int steal_take(StealPool *sp, int id, MatrixPair *pair);
+int steal_size(StealPool *sp, int id);
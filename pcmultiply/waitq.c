@@ -0,0 +1,166 @@
+/*
+ *  waitq module
+ *  Futex-based wait/notify for the bounded buffer engines
+ *
+ *  A waiter announces itself with waitq_prepare(), which returns a ticket
+ *  (the current value of the futex word), then rechecks its condition and
+ *  either gives up with waitq_cancel() or blocks in waitq_wait(ticket).
+ *  A notifier changes the state first, then calls waitq_notify(), which
+ *  bumps the word.  A notify that lands anywhere after the prepare moves
+ *  the word off the ticket, so the wait returns at once and no signal is
+ *  ever lost, with or without a lock around the state.
+ *
+ *  A notify for count threads leaves count wake tokens (never more than
+ *  there are waiters) before it bumps the word.  A waiter that sees the
+ *  word move has to claim a token to return.  If the others got there
+ *  first, it goes back to waiting on the new value.  So exactly count
+ *  waiters proceed, whether they were spinning or parked, as with
+ *  pthread_cond_signal().  waitq_notify_all() releases everyone for good.
+ *  Notifies skip the syscall entirely when nobody is waiting.
+ *  Waiters spin on the word for a while before parking.  The spin budget
+ *  doubles whenever a spin pays off and halves whenever it does not, so it
+ *  settles on what the current load rewards; it stays 0 on one CPU, where
+ *  the notifier cannot run while we spin.
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+// Include only libraries for this module
+#include <limits.h>
+#include <unistd.h>
+#include <immintrin.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "waitq.h"
+
+// this thread's share of the wait/notify work
+static __thread WaitStats myStats;
+
+void waitq_init(WaitQ *q)
+{
+  atomic_init(&q->seq, 0);
+  atomic_init(&q->waiters, 0);
+  atomic_init(&q->spinLimit, sysconf(_SC_NPROCESSORS_ONLN) > 1 ? WAITQ_SPIN_MIN : 0);
+  atomic_init(&q->tokens, 0);
+  atomic_init(&q->broadcast, 0);
+}
+
+// The word has moved off our ticket: take one of the wakes the notifies
+// left.  Returns 0 if other waiters claimed them all.
+static int claim_wake(WaitQ *q)
+{
+  if (atomic_load_explicit(&q->broadcast, memory_order_acquire))
+    return 1;
+  int t = atomic_load(&q->tokens);
+  while (t > 0)
+  {
+    if (atomic_compare_exchange_weak(&q->tokens, &t, t - 1))
+      return 1;
+  }
+  return 0;
+}
+
+// Announce a wait.  The caller must recheck its condition afterwards and
+// then call waitq_cancel() or waitq_wait() with the ticket.
+unsigned int waitq_prepare(WaitQ *q)
+{
+  atomic_fetch_add(&q->waiters, 1);
+  // pairs with the fence in waitq_notify(): either the notifier sees us
+  // counted, or we see its state change on the recheck
+  atomic_thread_fence(memory_order_seq_cst);
+  return atomic_load(&q->seq);
+}
+
+// The condition came true on the recheck, no need to wait
+void waitq_cancel(WaitQ *q)
+{
+  atomic_fetch_sub(&q->waiters, 1);
+}
+
+// Block until a notify issued after waitq_prepare() returned ticket hands
+// this thread one of its wakes
+void waitq_wait(WaitQ *q, unsigned int ticket)
+{
+  int limit = atomic_load_explicit(&q->spinLimit, memory_order_relaxed);
+  for (int i = 0; i < limit; i++)
+  {
+    unsigned int seq = atomic_load_explicit(&q->seq, memory_order_acquire);
+    if (seq != ticket)
+    {
+      // read the word before claiming: tokens go in before the bump, so a
+      // wake we miss here moves the word off the new ticket
+      if (!claim_wake(q))
+      {
+        ticket = seq;
+        continue;
+      }
+      myStats.spinWins++;
+      if (limit < WAITQ_SPIN_MAX)
+        atomic_store_explicit(&q->spinLimit, limit * 2, memory_order_relaxed);
+      atomic_fetch_sub(&q->waiters, 1);
+      return;
+    }
+    _mm_pause();
+  }
+  if (limit > WAITQ_SPIN_MIN)
+    atomic_store_explicit(&q->spinLimit, limit / 2, memory_order_relaxed);
+
+  myStats.parks++;
+  for (;;)
+  {
+    // FUTEX_WAIT returns straight away if the word has already moved on, and
+    // may return early for no reason, hence the loop
+    unsigned int seq;
+    while ((seq = atomic_load_explicit(&q->seq, memory_order_acquire)) == ticket)
+      syscall(SYS_futex, &q->seq, FUTEX_WAIT_PRIVATE, ticket, NULL, NULL, 0);
+    if (claim_wake(q))
+      break;
+    ticket = seq;
+  }
+  atomic_fetch_sub(&q->waiters, 1);
+}
+
+// Wake up to count waiters, after the state they wait on has changed
+void waitq_notify(WaitQ *q, int count)
+{
+  // pairs with the fence in waitq_prepare(), as the bump below used to
+  atomic_thread_fence(memory_order_seq_cst);
+  int waiters = atomic_load(&q->waiters);
+  if (waiters == 0)
+  {
+    // still move the word, a thread between prepare and its count being
+    // visible must not sleep through this
+    atomic_fetch_add(&q->seq, 1);
+    myStats.skipped++;
+    return;
+  }
+
+  // leave the wakes before moving the word, at most one per waiter so
+  // wakes nobody claims do not pile up
+  int t = atomic_load(&q->tokens);
+  int want;
+  do
+  {
+    want = count < waiters - t ? t + count : waiters;
+    if (want <= t)
+      break;
+  } while (!atomic_compare_exchange_weak(&q->tokens, &t, want));
+
+  atomic_fetch_add(&q->seq, 1);
+  myStats.wakes++;
+  syscall(SYS_futex, &q->seq, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+// Wake every waiter, for end of stream
+void waitq_notify_all(WaitQ *q)
+{
+  atomic_store_explicit(&q->broadcast, 1, memory_order_release);
+  waitq_notify(q, INT_MAX);
+}
+
+// Copy out what the wait queues counted for the calling thread
+void waitq_thread_stats(WaitStats *out)
+{
+  *out = myStats;
+}
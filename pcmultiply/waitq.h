@@ -0,0 +1,45 @@
+/*
+ *  waitq header
+ *  Function prototypes, data, and constants for the wait/notify module
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+#include <stdatomic.h>
+
+#define WAITQ_CACHE_LINE 64
+
+// Adaptive spin budget, in pause iterations, before a waiter parks
+#define WAITQ_SPIN_MIN 16
+#define WAITQ_SPIN_MAX 4096
+
+// An event count: waiters park on seq until a notify bumps it, then claim
+// one of the wake tokens the notify left.  Sits on its own cache line, it
+// is written by every notify.
+typedef struct waitq
+{
+  _Alignas(WAITQ_CACHE_LINE) atomic_uint seq; // futex word, bumped by every notify
+  atomic_int waiters;                         // threads between prepare and wait returning
+  atomic_int spinLimit;                       // current spin budget, 0 on one CPU
+  atomic_int tokens;                          // wakes handed out and not yet claimed
+  atomic_int broadcast;                       // set by waitq_notify_all(), every wait returns
+} WaitQ;
+
+// What the wait queues did on behalf of one thread
+typedef struct waitstats
+{
+  int spinWins; // waits satisfied while still spinning
+  int parks;    // waits that went to sleep in the kernel
+  int wakes;    // FUTEX_WAKE calls issued by notifies
+  int skipped;  // notifies that found nobody waiting and made no syscall
+} WaitStats;
+
+// WAIT QUEUE ROUTINES
+void waitq_init(WaitQ *q);
+unsigned int waitq_prepare(WaitQ *q);
+void waitq_cancel(WaitQ *q);
+void waitq_wait(WaitQ *q, unsigned int ticket);
+void waitq_notify(WaitQ *q, int count);
+void waitq_notify_all(WaitQ *q);
+void waitq_thread_stats(WaitStats *out);